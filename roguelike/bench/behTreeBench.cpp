@@ -0,0 +1,141 @@
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <spdlog/fmt/fmt.h>
+
+#include <behTree.hpp>
+#include <flatBehTree.hpp>
+
+
+template<class Node, class... Nodes>
+static std::vector<Node> nodes(Nodes... list)
+{
+  std::vector<Node> result;
+  (result.push_back(std::move(list)), ...);
+  return result;
+}
+
+// The same tree ticked by both runtimes, in agent ticks per second. Every
+// leaf finishes at once so the whole tree runs on every tick.
+int main()
+{
+  constexpr int AGENTS = 1000;
+  constexpr int TICKS = 1000;
+
+  auto timed = [](auto&& fn)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      fn();
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+  fmt::print("{:>10} {:>8} {:>14} {:>12}\n", "runtime", "agents", "Mticks/s", "state bytes");
+
+  {
+    using namespace beh_tree;
+    using Nodes = std::unique_ptr<Node>;
+    auto definition = TreeDefinition::build(
+      []()
+      {
+        std::vector<std::pair<Nodes, fu2::function<float(const Blackboard&) const>>> utility;
+        utility.emplace_back(beh_tree::fail(), [](const Blackboard&) { return 2.f; });
+        utility.emplace_back(beh_tree::succeed(), [](const Blackboard&) { return 1.f; });
+        return repeat(sequence(nodes<Nodes>(
+          select(nodes<Nodes>(beh_tree::fail(), predicate([](const Blackboard&) { return true; }, beh_tree::succeed()))),
+          parallel(nodes<Nodes>(beh_tree::succeed(), beh_tree::succeed())),
+          utility_select(std::move(utility)))));
+      });
+
+    flecs::world world;
+    for (int i = 0; i < AGENTS; ++i)
+    {
+      auto e = world.entity();
+      e.set(BehTree(e, definition));
+    }
+
+    // Same as the beh_tree_execute and beh_tree_act systems
+    const double took = timed(
+      [&]()
+      {
+        for (int tick = 0; tick < TICKS; ++tick)
+          world.each(
+            [](flecs::entity e, BehTree& tree, ActingNodes& actors)
+            {
+              tree.execute(e);
+              auto copy = actors.actingNodes;
+              for (auto node : copy)
+                node->act(tree.params(e));
+            });
+      });
+    fmt::print("{:>10} {:>8} {:>14.2f} {:>12}\n", "nodes", AGENTS, AGENTS * TICKS / took / 1e6, definition->initialState().size());
+  }
+
+  {
+    using namespace beh_tree::flat;
+    std::vector<std::pair<NodeDesc, UtilityFunc>> utility;
+    utility.emplace_back(fail(), [](const Blackboard&) { return 2.f; });
+    utility.emplace_back(succeed(), [](const Blackboard&) { return 1.f; });
+    auto tree = std::make_shared<const FlatTree>(repeat(sequence(nodes<NodeDesc>(
+      select(nodes<NodeDesc>(fail(), predicate([](const Blackboard&) { return true; }, succeed()))),
+      parallel(nodes<NodeDesc>(succeed(), succeed())),
+      utility_select(std::move(utility))))));
+
+    flecs::world world;
+    for (int i = 0; i < AGENTS; ++i)
+    {
+      auto e = world.entity();
+      e.set(FlatBehTree(e, tree));
+    }
+
+    const double took = timed(
+      [&]()
+      {
+        for (int tick = 0; tick < TICKS; ++tick)
+          world.each(
+            [](flecs::entity e, FlatBehTree& tree, Blackboard& bb, const EventList& evs)
+            {
+              tree.tick(e, bb, evs);
+            });
+      });
+    fmt::print("{:>10} {:>8} {:>14.2f} {:>12}\n", "flat", AGENTS, AGENTS * TICKS / took / 1e6, tree->initialState().size());
+  }
+
+  // Giving a wave of new agents a tree, one at a time against going through a prefab
+  {
+    using namespace beh_tree;
+    using Nodes = std::unique_ptr<Node>;
+    flecs::world world;
+    auto event = world.entity("bench_event");
+    auto definition = TreeDefinition::build(
+      [event]()
+      {
+        return repeat(sequence(nodes<Nodes>(
+          race(nodes<Nodes>(wait_event(event), beh_tree::succeed())),
+          parallel(nodes<Nodes>(beh_tree::succeed(), beh_tree::succeed())))));
+      });
+
+    constexpr int WAVE = 10000;
+    fmt::print("{:>10} {:>8} {:>14}\n", "spawn", "agents", "ms");
+
+    const double single = timed(
+      [&]()
+      {
+        for (int i = 0; i < WAVE; ++i)
+        {
+          auto e = world.entity();
+          e.set(BehTree(e, definition));
+        }
+      });
+    fmt::print("{:>10} {:>8} {:>14.3f}\n", "each", WAVE, single * 1e3);
+
+    auto prefab = make_agent_prefab(world, definition);
+    std::vector<flecs::entity> wave(WAVE);
+    for (auto& e : wave)
+      e = world.entity();
+    const double instantiated = timed([&]() { instantiate(wave, prefab); });
+    fmt::print("{:>10} {:>8} {:>14.3f}\n", "prefab", WAVE, instantiated * 1e3);
+
+    const double bulk = timed([&]() { spawn_agents(world, prefab, WAVE); });
+    fmt::print("{:>10} {:>8} {:>14.3f}\n", "bulk", WAVE, bulk * 1e3);
+  }
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <spdlog/fmt/fmt.h>
+
+#include "gameplay/dungeon/dungeon.hpp"
+#include "gameplay/dungeon/dungeonUtils.hpp"
+#include "gameplay/dungeon/dungeonGenerator.hpp"
+#include "gameplay/dungeon/dungeonFile.hpp"
+#include "gameplay/dungeon/regions.hpp"
+#include "gameplay/dungeon/workerPool.hpp"
+
+
+// Generation throughput of every generator, in map cells per second.
+// Caves run on all cores, the other generators on one.
+int main()
+{
+  constexpr int CELLS_PER_RUN = 1 << 24;
+  dungeon::WorkerPool workers;
+
+  fmt::print("{} worker(s)\n", workers.size());
+  fmt::print("{:>10} {:>6} {:>8} {:>8} {:>14} {:>12}\n", "generator", "size", "density", "levels", "Mcells/s", "ms/level");
+
+  for (auto kind : {dungeon::GeneratorKind::DrunkWalk, dungeon::GeneratorKind::Bsp, dungeon::GeneratorKind::Caves})
+  for (int size : {50, 128, 256, 512, 4096})
+  for (float density : {0.35f, 0.5f})
+  {
+    // Same amount of cells for every size, one buffer reused by all levels
+    const int levels = std::max(1, CELLS_PER_RUN / (size * size));
+    auto dd = dungeon::make_dungeon(size, size);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int seed = 0; seed < levels; ++seed)
+      dungeon::generate_dungeon(dd.view, {.kind = kind, .seed = std::uint64_t(seed), .density = density}, &workers);
+    const std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+    const char* name = kind == dungeon::GeneratorKind::DrunkWalk ? "drunk" : kind == dungeon::GeneratorKind::Bsp ? "bsp" : "caves";
+    const double cells = double(levels) * size * size;
+    fmt::print("{:>10} {:>6} {:>8.2f} {:>8} {:>14.2f} {:>12.3f}\n", name, size, density, levels, cells / took.count() / 1e6, took.count() * 1e3 / levels);
+  }
+
+  // Startup on a prebuilt map: generating it again against loading a saved copy
+  {
+    constexpr int size = 4096;
+    const auto path = std::filesystem::temp_directory_path() / "roguelike_generator_bench.dng";
+    auto timed = [](auto&& fn)
+      {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      };
+
+    dungeon::Dungeon dd;
+    dungeon::Regions regions;
+    const double generate = timed(
+      [&]()
+      {
+        dd = dungeon::generate_dungeon({.kind = dungeon::GeneratorKind::Caves, .width = size, .height = size}, &workers);
+        regions = dungeon::make_regions(dd);
+      });
+    dungeon::save_dungeon(path, dd, &regions);
+
+    // Checking the labels and building walkability reads the whole file once
+    std::optional<dungeon::LoadedDungeon> loaded;
+    const double load = timed([&]() { loaded = dungeon::load_dungeon(path); });
+    // The tiles are already paged in by then
+    std::ptrdiff_t floor = 0;
+    const double touch = timed(
+      [&]()
+      {
+        const auto& view = loaded->dungeon.view;
+        floor = std::count(view.data_handle(), view.data_handle() + view.size(), dungeon::Tile::Floor);
+      });
+
+    fmt::print("\n{:>10} {:>6} {:>12} {:>12} {:>12} {:>10}\n", "startup", "size", "generate ms", "load ms", "touch ms", "floor");
+    fmt::print("{:>10} {:>6} {:>12.3f} {:>12.3f} {:>12.3f} {:>10}\n", "caves", size, generate, load, touch, floor);
+    loaded.reset();
+    std::filesystem::remove(path);
+  }
+
+  return 0;
+}
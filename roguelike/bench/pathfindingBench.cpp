@@ -0,0 +1,83 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#include <spdlog/fmt/fmt.h>
+
+#include "gameplay/dungeon/dungeon.hpp"
+#include "gameplay/dungeon/dungeonUtils.hpp"
+#include "gameplay/dungeon/dungeonGenerator.hpp"
+#include "gameplay/dungeon/pathfinding.hpp"
+#include "gameplay/dungeon/jumpPointSearch.hpp"
+
+
+// Plain A* against jump point search, prints average node expansions and time per query.
+// Fails when the two disagree on any path length.
+int main()
+{
+  constexpr int QUERIES = 2000;
+  std::default_random_engine engine(42);
+
+  fmt::print("{:>6} {:>6} {:>14} {:>14} {:>12} {:>12} {:>10}\n", "map", "size", "A* expanded", "JPS expanded", "A* us", "JPS us", "mismatches");
+  bool failed = false;
+
+  // Drunk walk caves, and the same sizes as a single open hall with scattered pillars
+  for (bool open : {false, true})
+  for (int size : {50, 128, 256, 512})
+  {
+    auto dd = dungeon::generate_dungeon({.seed = 42, .width = size, .height = size});
+    if (open)
+    {
+      std::bernoulli_distribution pillar(0.02);
+      for (auto& tile : dd.data)
+        tile = pillar(engine) ? dungeon::Tile::Wall : dungeon::Tile::Floor;
+      dd.walkable = dungeon::make_walkability(dd);
+    }
+
+    std::vector<glm::ivec2> floor;
+    for (int y = 0; y < size; ++y)
+      for (int x = 0; x < size; ++x)
+        if (dd.view(y, x) == dungeon::Tile::Floor)
+          floor.push_back({x, y});
+
+    std::uniform_int_distribution<std::size_t> pick(0, floor.size() - 1);
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> queries(QUERIES);
+    for (auto& q : queries)
+      q = {floor[pick(engine)], floor[pick(engine)]};
+
+    dungeon::PathService astar(dd.view);
+    dungeon::JumpPointSearch jps(dd);
+    std::vector<glm::ivec2> path;
+
+    auto measure = [&](auto& search)
+      {
+        std::size_t expanded = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (auto [from, to] : queries)
+        {
+          search.find_path(dd, from, to, path);
+          expanded += search.expansions();
+        }
+        const std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start;
+        return std::pair{double(expanded) / QUERIES, took.count() / QUERIES};
+      };
+
+    const auto [astarExpanded, astarUs] = measure(astar);
+    const auto [jpsExpanded, jpsUs] = measure(jps);
+
+    // Both must agree on whether a path exists and on its length, untimed
+    int mismatches = 0;
+    std::vector<glm::ivec2> jpsPath;
+    for (auto [from, to] : queries)
+    {
+      const bool astarFound = astar.find_path(dd, from, to, path);
+      const bool jpsFound = jps.find_path(dd, from, to, jpsPath);
+      if (astarFound != jpsFound || path.size() != jpsPath.size())
+        ++mismatches;
+    }
+    failed = failed || mismatches > 0;
+
+    fmt::print("{:>6} {:>6} {:>14.1f} {:>14.1f} {:>12.2f} {:>12.2f} {:>10}\n", open ? "open" : "drunk", size, astarExpanded, jpsExpanded, astarUs, jpsUs, mismatches);
+  }
+
+  return failed ? 1 : 0;
+}
@@ -6,6 +6,8 @@
 #include <function2/function2.hpp>
 #include <limits>
 #include <optional>
+#include <random>
+#include <spdlog/spdlog.h>
 #include <spdlog/fmt/fmt.h>
 #include <allegro5/keycodes.h>
 #include <allegro5/allegro5.h>
@@ -21,10 +23,12 @@
 #include "gameplay/systems.hpp"
 #include "gameplay/aiSystems.hpp"
 #include "gameplay/entityFactories.hpp"
+#include "gameplay/levels.hpp"
 #include "gameplay/behTreeLibrary.hpp"
 #include "gameplay/actions.hpp"
 #include "gameplay/dungeon/dungeon.hpp"
 #include "gameplay/dungeon/dungeonGenerator.hpp"
+#include "gameplay/dungeon/levelPool.hpp"
 #include "gameplay/dungeon/dungeonUtils.hpp"
 
 
@@ -46,6 +50,7 @@ class Game
     : world_{self().world()}
     , endOfTurnPipeline_{register_systems(world_)}
     , simulateAiInfo_{register_ai_systems(world_)}
+    , levelPool_{world_.get<dungeon::Workers>()->pool}
     , smTracker_{world_, simulateAiInfo_.simulateAiPipieline, simulateAiInfo_.stateTransitionPhase}
     , drawableQuery_{
       world_.query_builder<const Position>()
@@ -63,40 +68,31 @@ class Game
     // auto skull = self().loadSprite(PROJECT_SOURCE_DIR "/roguelike/resources/skull.png");
 
     {
-      auto dng = dungeon::make_dungeon(50, 50);
-      dungeon::gen_drunk_dungeon(dng.view);
-      flecs::entity dngEntity = world_.entity("dungeon")
-        .set(std::move(dng));
-
-      create_dmap(world_, "dist_to_player", dngEntity,
-        world_.query_builder<const Position>().term<IsPlayer>().build(),
-        [](float)
-        {
-          return 1;
-        });
-
-      create_dmap(world_, "dist_to_player_short", dngEntity,
-        world_.query_builder<const Position>().term<IsPlayer>().build(),
-        [](float d)
-        {
-          return d > 4 ? 0 : 1; // non-linear weights
-        });
+      // Logged so that an interesting level can be generated again
+      seed_ = std::random_device{}();
+      spdlog::info("Dungeon seed {}", seed_);
+      createLevel(0);
+      // Queued after the first floor so the worker doesn't hold it up,
+      // the next one gets generated in the background while this one is played
+      levelPool_.prefetch(floor(1));
     }
 
-    create_player(world_, dungeon::find_walkable_tile(world_))
+    // Everything else spawns where the player can get to
+    const auto playerPos = dungeon::find_walkable_tile(world_);
+    create_player(world_, playerPos)
       .set<Sprite>({elfSprite});
 
 
     {
       struct UpdateHealthToBb{};
-      flecs::entity mob = create_monster(world_, dungeon::find_walkable_tile(world_)).set<Sprite>({gnollSprite});
+      flecs::entity mob = create_monster(world_, dungeon::find_walkable_tile(world_, playerPos)).set<Sprite>({gnollSprite});
       mob.set(SmartMovement
         {
           .potential =
             {
-              {"dungeon::dist_to_player", 1.f, "hp_high"},
-              {"dungeon::dist_to_player_short", -1.f, "hp_high"},
-              {"dungeon::dist_to_player", 1.f, "", -1},
+              {"dist_to_player", 1.f, "hp_high"},
+              {"dist_to_player_short", -1.f, "hp_high"},
+              {"dist_to_player", 1.f, "", -1},
             }
         })
         .add<UpdateHealthToBb>()
@@ -176,9 +172,7 @@ class Game
     //         // Prioritize looting
     //         beh_tree::sequence(vec(
     //           beh_tree::get_closest(
-    //             world_.query_builder<const Position>()
-    //               .term<HealAmount>().or_()
-    //               .term<PowerupAmount>().or_(),
+    //             [](flecs::entity e) { return e.has<HealAmount>() || e.has<PowerupAmount>(); },
     //             "buff"),
     //           beh_tree::move_to("buff")
     //         )),
@@ -344,8 +338,8 @@ class Game
 
     for (int i = 0; i < 10; ++i)
     {
-      create_powerup(world_, dungeon::find_walkable_tile(world_), 10.f);
-      create_heal(world_, dungeon::find_walkable_tile(world_), 50.f);
+      create_powerup(world_, dungeon::find_walkable_tile(world_, playerPos), 10.f);
+      create_heal(world_, dungeon::find_walkable_tile(world_, playerPos), 50.f);
     }
 
 
@@ -383,6 +377,12 @@ class Game
     case ALLEGRO_KEY_SPACE:
       action = ActionType::NOP;
       break;
+    case ALLEGRO_KEY_PGDN:
+      changeLevel(1);
+      return;
+    case ALLEGRO_KEY_PGUP:
+      changeLevel(-1);
+      return;
 
     default:
       return;
@@ -431,17 +431,22 @@ class Game
         auto name = e.name();
         if (ImGui::TreeNode(name.length() == 0 ? fmt::format("{}", e.id()).c_str() : name.c_str()))
         {
-          bt.drawDebug();
+          bt.drawDebug(e);
           ImGui::TreePop();
         }
       });
     ImGui::End();
 
-    static auto dmapQuery = world_.query<dungeon::dmaps::Dmap>();
+    static auto dmapQuery = world_.query<dungeon::dmaps::Dmap, const dungeon::dmaps::DmapUsers>();
     ImGui::Begin("Dmaps");
-    dmapQuery.each([](flecs::entity e, dungeon::dmaps::Dmap& dmap)
+    dmapQuery.each([](flecs::entity e, dungeon::dmaps::Dmap& dmap, const dungeon::dmaps::DmapUsers& users)
       {
         ImGui::Checkbox(e.name(), &dmap.debugDraw);
+        ImGui::SameLine();
+        if (dungeon::dmaps::is_active(dmap, users))
+          ImGui::Text("(%d users)", users.count);
+        else
+          ImGui::TextDisabled("(dormant)");
       });
     ImGui::End();
   }
@@ -452,8 +457,6 @@ class Game
     static auto wallSprite = self().loadSprite(PROJECT_SOURCE_DIR "/roguelike/resources/wall_mid.png");
     static auto floorSprite = self().loadSprite(PROJECT_SOURCE_DIR "/roguelike/resources/floor_1.png");
 
-    static auto dungeonQuery = world_.query<const dungeon::Dungeon>();
-
     auto bitmapFor = [&](dungeon::Tile tile)
       {
         switch (tile)
@@ -466,22 +469,20 @@ class Game
         }
       };
 
-    dungeonQuery.each(
-      [&](const dungeon::Dungeon& d)
+    // Only the floor the player is on, entities on the others are disabled
+    const auto& d = *world_.get<dungeon::CurrentDungeon>()->entity.get<dungeon::Dungeon>();
+    for (int y = 0; y < d.view.extent(0); ++y)
+      for (int x = 0; x < d.view.extent(1); ++x)
       {
-        for (int y = 0; y < d.view.extent(0); ++y)
-          for (int x = 0; x < d.view.extent(1); ++x)
-          {
-            auto min = project({x, y});
-            auto max = project(glm::ivec2{x, y} + glm::ivec2{1, 1});
+        auto min = project({x, y});
+        auto max = project(glm::ivec2{x, y} + glm::ivec2{1, 1});
 
-            auto bmp = bitmapFor(d.view(y, x));
-            al_draw_scaled_bitmap(
-              bmp,
-              0, 0, al_get_bitmap_width(bmp), al_get_bitmap_height(bmp),
-              min.x, min.y, max.x - min.x, max.y - min.y, ALLEGRO_FLIP_VERTICAL);
-          }
-      });
+        auto bmp = bitmapFor(d.view(y, x));
+        al_draw_scaled_bitmap(
+          bmp,
+          0, 0, al_get_bitmap_width(bmp), al_get_bitmap_height(bmp),
+          min.x, min.y, max.x - min.x, max.y - min.y, ALLEGRO_FLIP_VERTICAL);
+      }
 
     static auto dmapQuery = world_.query<dungeon::dmaps::Dmap>();
     dmapQuery.each([&](dungeon::dmaps::Dmap& dmap)
@@ -530,10 +531,45 @@ class Game
   Derived& self() { return *static_cast<Derived*>(this); }
   const Derived& self() const { return *static_cast<const Derived*>(this); }
 
+  dungeon::GeneratorParams floor(int depth) const
+  {
+    return dungeon::GeneratorParams{.kind = dungeon::GeneratorKind::DrunkWalk, .seed = seed_ + depth};
+  }
+
+  // Every level has a name of its own, dmaps get looked up relative to it
+  flecs::entity createLevel(int depth)
+  {
+    auto level = create_dungeon(world_, fmt::format("level_{}", depth), levelPool_.take(floor(depth)))
+      .set(Level{depth, floor(depth)});
+    load_dmaps(world_, level, PROJECT_SOURCE_DIR "/roguelike/resources/dmaps.yml");
+    return level;
+  }
+
+  // Takes the player a floor down or up, floors get generated on the first visit
+  void changeLevel(int delta)
+  {
+    auto player = world_.lookup("player");
+    const int depth = dungeon::dungeon_of(player).get<Level>()->depth + delta;
+    if (depth < 0)
+      return;
+
+    auto level = world_.lookup(fmt::format("level_{}", depth).c_str());
+    if (!level)
+    {
+      level = createLevel(depth);
+      levelPool_.prefetch(floor(depth + 1));
+    }
+    enter_level(world_, level, levelPool_);
+    travel(player, level, dungeon::find_walkable_tile(level));
+  }
+
  private:
   flecs::world& world_;
   flecs::entity endOfTurnPipeline_;
   SimulateAiInfo simulateAiInfo_;
+  // Shares the world's worker pool, so it comes after the systems
+  dungeon::LevelPool levelPool_;
+  unsigned seed_{0};
 
   StateMachineTracker smTracker_;
 
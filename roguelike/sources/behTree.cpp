@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <random>
+#include <algorithm>
 
 #include <assert.hpp>
 #include <imgui.h>
@@ -10,40 +11,79 @@
 namespace beh_tree
 {
 
+thread_local NodeArena* NodeArena::current_ = nullptr;
+
+void* NodeArena::allocate(std::size_t size)
+{
+  constexpr std::size_t ALIGN = alignof(std::max_align_t);
+  size = (size + ALIGN - 1) / ALIGN * ALIGN;
+  if (size > std::size_t(end_ - cursor_))
+  {
+    // Oversized nodes get a block of their own
+    const std::size_t blockSize = std::max(size, BLOCK_SIZE);
+    blocks_.push_back({std::unique_ptr<std::byte[]>(new std::byte[blockSize]), blockSize});
+    cursor_ = blocks_.back().data.get();
+    end_ = cursor_ + blockSize;
+  }
+  return std::exchange(cursor_, cursor_ + size);
+}
+
+// Every node starts with where it came from, so that deleting one doesn't
+// depend on which arena is current at the time
+struct alignas(std::max_align_t) NodeHeader
+{
+  NodeArena* arena;
+};
+
+void* Node::operator new(std::size_t size)
+{
+  NodeArena* arena = NodeArena::current();
+  void* memory = arena
+    ? arena->allocate(sizeof(NodeHeader) + size)
+    : ::operator new(sizeof(NodeHeader) + size);
+  return new (memory) NodeHeader{arena} + 1;
+}
+
+void Node::operator delete(void* ptr, std::size_t size)
+{
+  auto header = static_cast<NodeHeader*>(ptr) - 1;
+  // Arena memory goes away with the arena
+  if (!header->arena)
+    ::operator delete(header, sizeof(NodeHeader) + size);
+}
+
 template<class Derived>
 struct CompoundNode : Node, INodeCaller
 {
   std::vector<std::unique_ptr<Node>> children;
 
-  virtual void debugDraw() const override
+  virtual void debugDraw(flecs::entity entity, const std::byte* state) const override
   {
-    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running_ ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
+    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running(state) ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
     bool open = ImGui::TreeNodeEx(fmt::format("{}##{}", typeid(Derived).name(), fmt::ptr(this)).c_str());
     ImGui::PopStyleColor();
     if (open)
     {
       for (auto& child : children)
-        child->debugDraw();
+        child->debugDraw(entity, state);
       ImGui::TreePop();
     }
   }
 
-  std::unique_ptr<Node> clone() override
+  void layout(StateLayout& layout, const INodeCaller* owner) override
   {
-    std::unique_ptr<Derived> result{new Derived};
-    result->children.reserve(children.size());
+    Node::layout(layout, owner);
     for (auto& child : children)
-      result->children.emplace_back(child->clone());
-    return std::move(result);
+      child->layout(layout, this);
   }
 
-  void connect(flecs::entity entity, INodeCaller* owner) override
+  std::size_t indexOf(const Node* which) const
   {
-    Node::connect(entity, owner);
-    for (auto& child : children)
-    {
-      child->connect(entity, this);
-    }
+    std::size_t i = 0;
+    while (i < children.size() && children[i].get() != which)
+      ++i;
+    NG_ASSERT(i < children.size());
+    return i;
   }
 };
 
@@ -52,41 +92,74 @@ struct AdapterNode : Node, INodeCaller
 {
   std::unique_ptr<Node> adapted;
 
-  virtual void debugDraw() const override
+  virtual void debugDraw(flecs::entity entity, const std::byte* state) const override
   {
-    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running_ ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
+    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running(state) ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
     bool open = ImGui::TreeNodeEx(fmt::format("{}##{}", typeid(Derived).name(), fmt::ptr(this)).c_str());
     ImGui::PopStyleColor();
     if (open)
     {
-      adapted->debugDraw();
+      adapted->debugDraw(entity, state);
       ImGui::TreePop();
     }
   }
 
-  std::unique_ptr<Node> clone() override
-  {
-    std::unique_ptr<Derived> result{new Derived};
-    result->adapted = adapted->clone();
-    return std::move(result);
-  }
-
-  void connect(flecs::entity entity, INodeCaller* owner) override
+  void layout(StateLayout& layout, const INodeCaller* owner) override
   {
-    Node::connect(entity, owner);
-    adapted->connect(entity, this);
+    Node::layout(layout, owner);
+    adapted->layout(layout, this);
   }
 };
 
+flecs::entity make_agent_prefab(flecs::world& world, std::shared_ptr<const TreeDefinition> definition)
+{
+  auto prefab = world.prefab();
+  for (auto tag : definition->tags())
+    prefab.add(tag);
+  prefab
+    .set_override(EventList{})
+    .set_override(Blackboard{})
+    .set_override(ActingNodes{})
+    .set_override(ReactingNodes{})
+    .set_override(BehTree(std::move(definition)));
+  return prefab;
+}
+
+void instantiate(std::span<const flecs::entity> agents, flecs::entity prefab)
+{
+  for (auto e : agents)
+    e.is_a(prefab);
+}
+
+std::vector<flecs::entity> spawn_agents(flecs::world& world, flecs::entity prefab, std::int32_t count)
+{
+  ecs_bulk_desc_t desc{};
+  desc.count = count;
+  desc.ids[0] = ecs_pair(EcsIsA, prefab.id());
+  const ecs_entity_t* ids = ecs_bulk_init(world.c_ptr(), &desc);
+
+  std::vector<flecs::entity> result;
+  result.reserve(count);
+  for (std::int32_t i = 0; i < count; ++i)
+    result.push_back(flecs::entity(world, ids[i]));
+  return result;
+}
+
 std::unique_ptr<Node> sequence(std::vector<std::unique_ptr<Node>> nodes)
 {
   struct SequenceNode : CompoundNode<SequenceNode>
   {
-    size_t current = 0;
+    std::uint32_t currentOffset;
 
-    void executeImpl(RunParams params) override
+    void layout(StateLayout& layout, const INodeCaller* owner) override
     {
-      NG_ASSERT(current == 0);
+      currentOffset = layout.claim<std::uint32_t>();
+      CompoundNode::layout(layout, owner);
+    }
+
+    void executeImpl(RunParams params) const override
+    {
+      NG_ASSERT(at<std::uint32_t>(params, currentOffset) == 0);
 
       if (children.empty())
       {
@@ -97,14 +170,16 @@ std::unique_ptr<Node> sequence(std::vector<std::unique_ptr<Node>> nodes)
       children.front()->execute(params);
     }
 
-    void cancelImpl(RunParams params) override
+    void cancelImpl(RunParams params) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       children[current]->cancel(params);
       current = 0;
     }
 
-    void succeeded(RunParams params, Node* which) override
+    void succeeded(RunParams params, const Node* which) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       NG_ASSERT(which == children[current].get());
 
       if (++current == children.size())
@@ -117,8 +192,9 @@ std::unique_ptr<Node> sequence(std::vector<std::unique_ptr<Node>> nodes)
       children[current]->execute(params);
     }
 
-    void failed(RunParams params, Node* which) override
+    void failed(RunParams params, const Node* which) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       NG_ASSERT(which == children[current].get());
 
       current = 0;
@@ -127,7 +203,7 @@ std::unique_ptr<Node> sequence(std::vector<std::unique_ptr<Node>> nodes)
   };
 
   auto result = std::make_unique<SequenceNode>();
-  std::move(nodes.begin(), nodes.end(), std::back_inserter(result->children));
+  result->children = std::move(nodes);
   return result;
 }
 
@@ -135,11 +211,17 @@ std::unique_ptr<Node> select(std::vector<std::unique_ptr<Node>> nodes)
 {
   struct SelectNode : CompoundNode<SelectNode>
   {
-    size_t current = 0;
+    std::uint32_t currentOffset;
+
+    void layout(StateLayout& layout, const INodeCaller* owner) override
+    {
+      currentOffset = layout.claim<std::uint32_t>();
+      CompoundNode::layout(layout, owner);
+    }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      NG_ASSERT(current == 0);
+      NG_ASSERT(at<std::uint32_t>(params, currentOffset) == 0);
 
       if (children.empty())
       {
@@ -150,21 +232,24 @@ std::unique_ptr<Node> select(std::vector<std::unique_ptr<Node>> nodes)
       children.front()->execute(params);
     }
 
-    void cancelImpl(RunParams params) override
+    void cancelImpl(RunParams params) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       children[current]->cancel(params);
       current = 0;
     }
 
-    void succeeded(RunParams params, Node* which) override
+    void succeeded(RunParams params, const Node* which) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       NG_ASSERT(which == children[current].get());
       current = 0;
       succeed(params);
     }
 
-    void failed(RunParams params, Node* which) override
+    void failed(RunParams params, const Node* which) const override
     {
+      auto& current = at<std::uint32_t>(params, currentOffset);
       NG_ASSERT(which == children[current].get());
 
       if (++current == children.size())
@@ -179,49 +264,58 @@ std::unique_ptr<Node> select(std::vector<std::unique_ptr<Node>> nodes)
   };
 
   auto result = std::make_unique<SelectNode>();
-  std::move(nodes.begin(), nodes.end(), std::back_inserter(result->children));
+  result->children = std::move(nodes);
   return result;
 }
 
 std::unique_ptr<Node> utility_select(std::vector<std::pair<std::unique_ptr<Node>, fu2::function<float(const Blackboard&) const>>> nodes)
 {
-  static constexpr float PER_EXECUTE_BIAS_INCREASE = 2.0f;
-  static constexpr float PER_EXECUTE_BIAS_DECREASE = 1.0f;
-
   struct SelectNode : CompoundNode<SelectNode>
   {
     std::vector<fu2::function<float(const Blackboard&) const>> utilityFuncs;
-    std::vector<float> biases;
-    std::unordered_map<std::size_t, float> leftToExecute;
-    std::size_t currentlyExecuting = 0;
+    // One per child: bias, utility plus bias at the start of the run
+    // and whether it is still left to execute
+    std::uint32_t biasesOffset;
+    std::uint32_t weightsOffset;
+    std::uint32_t leftOffset;
+    std::uint32_t currentOffset;
+
+    void layout(StateLayout& layout, const INodeCaller* owner) override
+    {
+      biasesOffset = layout.claim<float>(children.size());
+      weightsOffset = layout.claim<float>(children.size());
+      leftOffset = layout.claim<bool>(children.size());
+      currentOffset = layout.claim<std::uint32_t>();
+      CompoundNode::layout(layout, owner);
+    }
 
+    float* biases(RunParams params) const { return &at<float>(params, biasesOffset); }
+    float* weights(RunParams params) const { return &at<float>(params, weightsOffset); }
+    bool* left(RunParams params) const { return &at<bool>(params, leftOffset); }
 
-    virtual void debugDraw() const override
+    virtual void debugDraw(flecs::entity entity, const std::byte* state) const override
     {
-      ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running_ ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
+      ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(running(state) ? ImColor(0, 255, 0) : ImColor(255, 255, 255)));
       bool open = ImGui::TreeNodeEx(fmt::format("{}##{}", typeid(SelectNode).name(), fmt::ptr(this)).c_str());
       ImGui::PopStyleColor();
       if (open)
       {
-        std::vector<float> utilities;
-        utilities.reserve(utilityFuncs.size());
-        for (auto& func : utilityFuncs)
-          utilities.push_back(func(*entity_.get<Blackboard>()));
-
+        const float* biases = &at<float>(state, biasesOffset);
         for (size_t i = 0; auto& child : children)
         {
+          const float utility = utilityFuncs[i](*entity.get<Blackboard>());
           ImGui::Text("Utility: %f - %f = %f",
-            utilities[i], biases[i], std::max(0.f, utilities[i] - biases[i]));
+            utility, biases[i], std::max(0.f, utility - biases[i]));
           ++i;
-          child->debugDraw();
+          child->debugDraw(entity, state);
         }
         ImGui::TreePop();
       }
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      NG_ASSERT(leftToExecute.size() == 0);
+      NG_ASSERT(std::none_of(left(params), left(params) + children.size(), [](bool l) { return l; }));
 
       if (children.empty())
       {
@@ -229,69 +323,77 @@ std::unique_ptr<Node> utility_select(std::vector<std::pair<std::unique_ptr<Node>
         return;
       }
 
-      for (auto& bias : biases)
-        bias = bias > PER_EXECUTE_BIAS_DECREASE ? bias - PER_EXECUTE_BIAS_DECREASE : 0;
+      auto biases = this->biases(params);
+      for (std::size_t i = 0; i < children.size(); ++i)
+        biases[i] = biases[i] > UTILITY_BIAS_DECREASE ? biases[i] - UTILITY_BIAS_DECREASE : 0;
 
-      leftToExecute.reserve(utilityFuncs.size());
-      entity_.get([this]
+      params.entity.get([this, params, biases]
         (Blackboard& bb)
         {
           for (std::size_t i = 0; auto& func : utilityFuncs)
           {
-            leftToExecute.emplace(i, func(bb) + biases[i]);
+            weights(params)[i] = func(bb) + biases[i];
+            left(params)[i] = true;
             ++i;
           }
         });
 
-      children[pickChild()]->execute(params);
+      children[pickChild(params)]->execute(params);
     }
 
-    std::size_t pickChild()
+    std::size_t pickChild(RunParams params) const
     {
       static std::default_random_engine eng;
 
+      auto biases = this->biases(params);
+      auto left = this->left(params);
       std::vector<float> weights;
-      for (auto[i, w] : leftToExecute)
-        weights.emplace_back(std::max(0.f, w - biases[i]));
+      std::vector<std::size_t> indices;
+      for (std::size_t i = 0; i < children.size(); ++i)
+        if (left[i])
+        {
+          weights.emplace_back(std::max(0.f, this->weights(params)[i] - biases[i]));
+          indices.push_back(i);
+        }
       std::discrete_distribution<std::size_t> distr(weights.begin(), weights.end());
 
-      currentlyExecuting = distr(eng);
-      biases[currentlyExecuting] += PER_EXECUTE_BIAS_INCREASE;
-      leftToExecute.erase(currentlyExecuting);
-      return currentlyExecuting;
+      const std::size_t picked = indices[distr(eng)];
+      at<std::uint32_t>(params, currentOffset) = std::uint32_t(picked);
+      biases[picked] += UTILITY_BIAS_INCREASE;
+      left[picked] = false;
+      return picked;
     }
 
-    void cancelImpl(RunParams params) override
+    void cancelImpl(RunParams params) const override
     {
-      children[currentlyExecuting]->cancel(params);
-      leftToExecute.clear();
+      children[at<std::uint32_t>(params, currentOffset)]->cancel(params);
+      std::fill_n(left(params), children.size(), false);
     }
 
-    void succeeded(RunParams params, Node* which) override
+    void succeeded(RunParams params, const Node* which) const override
     {
-      NG_ASSERT(which == children[currentlyExecuting].get());
-      leftToExecute.clear();
+      NG_ASSERT(which == children[at<std::uint32_t>(params, currentOffset)].get());
+      std::fill_n(left(params), children.size(), false);
       succeed(params);
     }
 
-    void failed(RunParams params, Node* which) override
+    void failed(RunParams params, const Node* which) const override
     {
-      NG_ASSERT(which == children[currentlyExecuting].get());
+      NG_ASSERT(which == children[at<std::uint32_t>(params, currentOffset)].get());
 
-      if (leftToExecute.empty())
+      if (std::none_of(left(params), left(params) + children.size(), [](bool l) { return l; }))
       {
         fail(params);
         return;
       }
 
-      children[pickChild()]->execute(params);
+      children[pickChild(params)]->execute(params);
     }
   };
 
   auto result = std::make_unique<SelectNode>();
   result->children.reserve(nodes.size());
   result->utilityFuncs.reserve(nodes.size());
-  result->biases.resize(nodes.size(), 0);
   for (auto&[node, func] : nodes)
   {
     result->children.push_back(std::move(node));
@@ -304,77 +406,80 @@ std::unique_ptr<Node> parallel(std::vector<std::unique_ptr<Node>> nodes)
 {
   struct ParallelNode : CompoundNode<ParallelNode>
   {
-    size_t finished = 0;
-    std::vector<bool> running;
+    std::uint32_t finishedOffset;
+    std::uint32_t runningOffset;
+
+    void layout(StateLayout& layout, const INodeCaller* owner) override
+    {
+      finishedOffset = layout.claim<std::uint32_t>();
+      runningOffset = layout.claim<bool>(children.size());
+      CompoundNode::layout(layout, owner);
+    }
 
-    void executeImpl(RunParams params) override
+    bool* childRunning(RunParams params) const { return &at<bool>(params, runningOffset); }
+
+    void executeImpl(RunParams params) const override
     {
-      NG_ASSERT(finished == 0);
+      NG_ASSERT(at<std::uint32_t>(params, finishedOffset) == 0);
       if (children.empty())
       {
         succeed(params);
         return;
       }
-      
+
       for (size_t i = 0; i < children.size(); ++i)
       {
-        // A node may fail as soon as it is executed
-        running[i] = true;
+        // A node may finish as soon as it is executed, only
+        // failing stops the rest from starting
+        childRunning(params)[i] = true;
         children[i]->execute(params);
-        if (!running[i])
+        if (!running(params.state))
           break;
       }
     }
 
-    void cancelChildren(RunParams params)
+    void cancelChildren(RunParams params) const
     {
       for (size_t i = 0; i < children.size(); ++i)
-        if (running[i])
+        if (childRunning(params)[i])
           children[i]->cancel(params);
     }
-    
-    void cancelImpl(RunParams params) override
+
+    void reset(RunParams params) const
     {
-      cancelChildren(params);
-      finished = 0;
-      running.assign(children.size(), false);
+      at<std::uint32_t>(params, finishedOffset) = 0;
+      std::fill_n(childRunning(params), children.size(), false);
     }
 
-    void childFinished(Node* which)
+    void cancelImpl(RunParams params) const override
     {
-      for (size_t i = 0; i < children.size(); ++i)
-      {
-        if (children[i].get() == which)
-          running[i] = false;         
-      }
+      cancelChildren(params);
+      reset(params);
     }
 
-    void succeeded(RunParams params, Node* which) override
+    void succeeded(RunParams params, const Node* which) const override
     {
-      childFinished(which);
+      childRunning(params)[indexOf(which)] = false;
 
-      if (++finished == children.size())
+      if (++at<std::uint32_t>(params, finishedOffset) == children.size())
       {
-        finished = 0;
-        running.assign(children.size(), false);
+        reset(params);
         succeed(params);
       }
     }
 
-    void failed(RunParams params, Node* which) override
+    void failed(RunParams params, const Node* which) const override
     {
-      childFinished(which);
+      childRunning(params)[indexOf(which)] = false;
 
       cancelChildren(params);
-      finished = 0;
-      running.assign(children.size(), false);
+      reset(params);
       fail(params);
     }
   };
 
   auto result = std::make_unique<ParallelNode>();
-  result->running.resize(nodes.size());
-  std::move(nodes.begin(), nodes.end(), std::back_inserter(result->children));
+  result->children = std::move(nodes);
   return result;
 }
 
@@ -383,39 +488,47 @@ std::unique_ptr<Node> race(std::vector<std::unique_ptr<Node>> nodes)
 {
   struct RaceNode : CompoundNode<RaceNode>
   {
-    std::vector<bool> running;
+    std::uint32_t runningOffset;
+
+    void layout(StateLayout& layout, const INodeCaller* owner) override
+    {
+      runningOffset = layout.claim<bool>(children.size());
+      CompoundNode::layout(layout, owner);
+    }
+
+    bool* childRunning(RunParams params) const { return &at<bool>(params, runningOffset); }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
       for (size_t i = 0; i < children.size(); ++i)
       {
-        running[i] = true;
+        childRunning(params)[i] = true;
         children[i]->execute(params);
-        if (!running[i])
+        if (!childRunning(params)[i])
           break;
       }
     }
 
-    void cancelChildren(RunParams params, Node* except)
+    void cancelChildren(RunParams params, const Node* except) const
     {
       for (size_t i = 0; i < children.size(); ++i)
-        if (children[i].get() != except && running[i])
+        if (children[i].get() != except && childRunning(params)[i])
           children[i]->cancel(params);
-      running.assign(children.size(), false);
+      std::fill_n(childRunning(params), children.size(), false);
     }
-    
-    void cancelImpl(RunParams params) override
+
+    void cancelImpl(RunParams params) const override
     {
       cancelChildren(params, nullptr);
     }
 
-    void succeeded(RunParams params, Node* which) override
+    void succeeded(RunParams params, const Node* which) const override
     {
       cancelChildren(params, which);
       succeed(params);
     }
 
-    void failed(RunParams params, Node* which) override
+    void failed(RunParams params, const Node* which) const override
     {
       cancelChildren(params, which);
       fail(params);
@@ -423,8 +536,7 @@ std::unique_ptr<Node> race(std::vector<std::unique_ptr<Node>> nodes)
   };
 
   auto result = std::make_unique<RaceNode>();
-  result->running.resize(nodes.size(), false);
-  std::move(nodes.begin(), nodes.end(), std::back_inserter(result->children));
+  result->children = std::move(nodes);
   return result;
 }
 
@@ -432,39 +544,45 @@ std::unique_ptr<Node> repeat(std::unique_ptr<Node> node)
 {
   struct RepeatNode : AdapterNode<RepeatNode>, IActor
   {
-    bool running = false;
+    std::uint32_t adaptedRunningOffset;
+
+    void layout(StateLayout& layout, const INodeCaller* owner) override
+    {
+      adaptedRunningOffset = layout.claim<bool>();
+      AdapterNode::layout(layout, owner);
+    }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      entity_.get([this](ActingNodes& a)
+      params.entity.get([this](ActingNodes& a)
         {
           a.actingNodes.emplace(this);
         });
-      running = true;
+      at<bool>(params, adaptedRunningOffset) = true;
       adapted->execute(params);
     }
 
-    void act(RunParams params) override
+    void act(RunParams params) const override
     {
-      if (!std::exchange(running, true))
+      if (!std::exchange(at<bool>(params, adaptedRunningOffset), true))
         adapted->execute(params);
     }
 
-    void cancelImpl(RunParams) override
+    void cancelImpl(RunParams params) const override
     {
-      running = false;
-      entity_.get([this](ActingNodes& a)
+      at<bool>(params, adaptedRunningOffset) = false;
+      params.entity.get([this](ActingNodes& a)
         {
           a.actingNodes.erase(this);
         });
     }
 
-    void succeeded(RunParams, Node*) override
+    void succeeded(RunParams params, const Node*) const override
     {
-      running = false;
+      at<bool>(params, adaptedRunningOffset) = false;
     }
 
-    void failed(RunParams params, Node*) override
+    void failed(RunParams params, const Node*) const override
     {
       cancelImpl(params);
       fail(params);
@@ -477,15 +595,15 @@ std::unique_ptr<Node> repeat(std::unique_ptr<Node> node)
 }
 
 std::unique_ptr<Node> detail::predicate_internal(
-  fu2::function<bool(flecs::entity)> pred, std::unique_ptr<Node> execute)
+  fu2::function<bool(flecs::entity) const> pred, std::unique_ptr<Node> execute)
 {
   struct PredicateNode final : AdapterNode<PredicateNode>
   {
-    fu2::function<bool(flecs::entity)> predicate;
+    fu2::function<bool(flecs::entity) const> predicate;
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      if (!predicate(entity_))
+      if (!predicate(params.entity))
       {
         fail(params);
         return;
@@ -493,20 +611,13 @@ std::unique_ptr<Node> detail::predicate_internal(
       adapted->execute(params);
     }
 
-    void cancelImpl(RunParams params) override
+    void cancelImpl(RunParams params) const override
     {
       adapted->cancel(params);
     }
 
-    std::unique_ptr<Node> clone() override
-    {
-      auto result = AdapterNode::clone();
-      static_cast<PredicateNode*>(result.get())->predicate = predicate;
-      return std::move(result);
-    }
-    
-    void succeeded(RunParams params, Node*) override { succeed(params); }
-    void failed(RunParams params, Node*) override { fail(params); }
+    void succeeded(RunParams params, const Node*) const override { succeed(params); }
+    void failed(RunParams params, const Node*) const override { fail(params); }
   };
 
   auto result = std::make_unique<PredicateNode>();
@@ -521,29 +632,30 @@ std::unique_ptr<Node> wait_event(flecs::entity ev)
   {
     flecs::entity event;
 
-    void connect(flecs::entity entity, INodeCaller* owner) override
+    void layout(StateLayout& layout, const INodeCaller* owner) override
     {
-      ActionNode::connect(entity, owner);
-      entity.add(event);
+      ActionNode::layout(layout, owner);
+      // Lets the event dispatchers know the agent cares
+      layout.tags.push_back(event);
     }
 
-    void executeImpl(RunParams) override
+    void executeImpl(RunParams params) const override
     {
-      entity_.get([this](ReactingNodes& r)
+      params.entity.get([this](ReactingNodes& r)
         {
           r.eventReactors.emplace(event, this);
         });
     }
 
-    void act(RunParams params) override
+    void act(RunParams params) const override
     {
       cancelImpl(params);
       succeed(params);
     }
 
-    void cancelImpl(RunParams) override
+    void cancelImpl(RunParams params) const override
     {
-      entity_.get([this](ReactingNodes& r)
+      params.entity.get([this](ReactingNodes& r)
         {
           auto[b, e] = r.eventReactors.equal_range(event);
           while (b != e && b->second != this) ++b;
@@ -562,7 +674,7 @@ std::unique_ptr<Node> fail()
 {
   struct FailNode final : InstantActionNode<FailNode>
   {
-    void executeImpl(RunParams params) override { fail(params); }
+    void executeImpl(RunParams params) const override { fail(params); }
   };
 
   return std::make_unique<FailNode>();
@@ -572,7 +684,7 @@ std::unique_ptr<Node> succeed()
 {
   struct SucceedNode final : InstantActionNode<SucceedNode>
   {
-    void executeImpl(RunParams params) override { succeed(params); }
+    void executeImpl(RunParams params) const override { succeed(params); }
   };
 
   return std::make_unique<SucceedNode>();
@@ -593,10 +705,10 @@ std::unique_ptr<Node> get_pair_target(std::string_view bb_from, flecs::entity re
     {
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
       bool failed = false;
-      entity_.get([this, &failed](Blackboard& bb)
+      params.entity.get([this, &failed](Blackboard& bb)
         {
           auto e = bb.get<flecs::entity>(bbFrom);
 
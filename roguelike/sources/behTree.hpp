@@ -2,8 +2,15 @@
 
 #include "assert.hpp"
 #include "imgui.h"
+#include <new>
+#include <span>
 #include <vector>
 #include <memory>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <unordered_set>
 #include <unordered_map>
 
@@ -17,31 +24,42 @@
 namespace beh_tree
 {
 
-// Note: the design is slow af because we store a new tree hierarchy for each actor.
-// This can be easily mitigated by storing entity -> data maps inside nodes, but
-// that's too much work for a homework assignment.
+// Trees are split in two: an immutable definition made of nodes, shared by
+// every agent running the tree, and a small per-agent state block. Nodes
+// claim their slice of the block when the definition gets built and find
+// their state through RunParams.
 
 class Node;
 class IActor;
 class BehTree;
 
+// Running a child of a utility select raises its bias, every new pick
+// lowers all of them again. Both runtimes go by these.
+inline constexpr float UTILITY_BIAS_INCREASE = 2.0f;
+inline constexpr float UTILITY_BIAS_DECREASE = 1.0f;
+
 struct ActingNodes
 {
-  std::unordered_set<IActor*> actingNodes;
+  std::unordered_set<const IActor*> actingNodes;
 };
 
 struct ReactingNodes
 {
-  std::unordered_multimap<flecs::entity, IActor*> eventReactors;
+  std::unordered_multimap<flecs::entity, const IActor*> eventReactors;
 };
 
-struct RunParams {};
+struct RunParams
+{
+  flecs::entity entity;
+  // State block of the agent's tree
+  std::byte* state;
+};
 
 class INodeCaller
 {
 public:
-  virtual void succeeded(RunParams params, Node* which) = 0;
-  virtual void failed(RunParams params, Node* which) = 0;
+  virtual void succeeded(RunParams params, const Node* which) const = 0;
+  virtual void failed(RunParams params, const Node* which) const = 0;
 
   virtual ~INodeCaller() = default;
 };
@@ -49,146 +67,275 @@ public:
 class IActor
 {
 public:
-  virtual void act(RunParams params) = 0;
+  virtual void act(RunParams params) const = 0;
+};
+
+// Lays out the state block while a definition gets built
+struct StateLayout
+{
+  // Offset of a slice for `count` Ts, every agent starts with copies of `init`
+  template<class T>
+  std::uint32_t claim(std::size_t count = 1, const T& init = T{})
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "state blocks get copied with memcpy");
+    const std::size_t offset = (initial.size() + alignof(T) - 1) / alignof(T) * alignof(T);
+    initial.resize(offset + count * sizeof(T));
+    for (std::size_t i = 0; i < count; ++i)
+      std::memcpy(initial.data() + offset + i * sizeof(T), &init, sizeof(T));
+    return std::uint32_t(offset);
+  }
+
+  std::vector<std::byte> initial;
+  // Added to every agent running the tree
+  std::vector<flecs::entity> tags;
+};
+
+// Bump allocator for the nodes of one definition, they all go away at once
+class NodeArena
+{
+public:
+  NodeArena() = default;
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  void* allocate(std::size_t size);
+
+  // Nodes created while a scope is alive are placed in its arena
+  class Scope
+  {
+  public:
+    explicit Scope(NodeArena& arena) : previous_{std::exchange(current_, &arena)} {}
+    ~Scope() { current_ = previous_; }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    NodeArena* previous_;
+  };
+
+  static NodeArena* current() { return current_; }
+
+private:
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+
+  struct Block
+  {
+    std::unique_ptr<std::byte[]> data;
+    std::size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  std::byte* cursor_{nullptr};
+  std::byte* end_{nullptr};
+
+  static thread_local NodeArena* current_;
 };
 
 class Node
 {
 public:
-  void execute(RunParams params)
+  static void* operator new(std::size_t size);
+  static void operator delete(void* ptr, std::size_t size);
+
+  void execute(RunParams params) const
   {
-    start();
+    start(params);
     executeImpl(params);
   }
 
-  void cancel(RunParams params)
+  void cancel(RunParams params) const
   {
-    stop();
+    stop(params);
     cancelImpl(params);
   }
 
-  virtual void debugDraw() const = 0;
+  virtual void debugDraw(flecs::entity entity, const std::byte* state) const = 0;
 
   // Invariant: can only be called if execute was called
   // but the caller has not received a succeeded/failed
   // signal yet.
 
-  // cloning polymorphic hierarchies is a pain
-  virtual std::unique_ptr<Node> clone() = 0;
-
-  // Called exactly once after tree has been initialized
-  virtual void connect(flecs::entity entity, INodeCaller* owner) { entity_ = entity; owner_ = owner; };
+  // Called exactly once, when the definition gets built
+  virtual void layout(StateLayout& layout, const INodeCaller* owner)
+  {
+    owner_ = owner;
+    runningOffset_ = layout.claim<bool>();
+  }
 
   virtual ~Node() = default;
 
 protected:
-  virtual void executeImpl(RunParams params) = 0;
-  virtual void cancelImpl(RunParams params) = 0;
+  virtual void executeImpl(RunParams params) const = 0;
+  virtual void cancelImpl(RunParams params) const = 0;
 
-  void succeed(RunParams params) { stop(); owner_->succeeded(params, this); }
-  void fail(RunParams params) { stop(); owner_->failed(params, this); }
+  void succeed(RunParams params) const { stop(params); owner_->succeeded(params, this); }
+  void fail(RunParams params) const { stop(params); owner_->failed(params, this); }
+
+  bool running(const std::byte* state) const { return at<bool>(state, runningOffset_); }
+
+  template<class T>
+  static T& at(RunParams params, std::uint32_t offset)
+  {
+    return *std::launder(reinterpret_cast<T*>(params.state + offset));
+  }
+
+  template<class T>
+  static const T& at(const std::byte* state, std::uint32_t offset)
+  {
+    return *std::launder(reinterpret_cast<const T*>(state + offset));
+  }
 
 private:
-  void start() { NG_ASSERT(!std::exchange(running_, true)); }
-  void stop() { NG_ASSERT(std::exchange(running_, false)); }
+  void start(RunParams params) const { NG_ASSERT(!std::exchange(at<bool>(params, runningOffset_), true)); }
+  void stop(RunParams params) const { NG_ASSERT(std::exchange(at<bool>(params, runningOffset_), false)); }
 
-protected:
-  bool running_ = false;
-  flecs::entity entity_;
-  INodeCaller* owner_{nullptr};
+private:
+  std::uint32_t runningOffset_{0};
+  const INodeCaller* owner_{nullptr};
 };
 
-// Convenience base class for nodes with simple cloning logic
+// Convenience base class for leaf nodes
 template<class Derived>
 struct ActionNode : Node
 {
-  virtual void debugDraw() const override
+  virtual void debugDraw(flecs::entity, const std::byte* state) const override
   {
-    ImGui::TextColored(ImVec4(running_ ? ImColor(0, 255, 0) : ImColor(255, 255, 255)),
-      "%s##%p", typeid(Derived).name(), this);
-  }
-
-  std::unique_ptr<Node> clone() override
-  {
-    return std::make_unique<Derived>(static_cast<const Derived&>(*this));
+    ImGui::TextColored(ImVec4(this->running(state) ? ImColor(0, 255, 0) : ImColor(255, 255, 255)),
+      "%s##%p", typeid(Derived).name(), static_cast<const void*>(this));
   }
 };
 
 template<class Derived>
 struct InstantActionNode : ActionNode<Derived>
 {
-  void cancelImpl(RunParams) override {}
+  void cancelImpl(RunParams) const override {}
 };
 
+// Built once and shared by every agent running the tree
+class TreeDefinition : INodeCaller
+{
+public:
+  explicit TreeDefinition(std::unique_ptr<Node> root, std::unique_ptr<NodeArena> arena = nullptr)
+    : arena_{std::move(arena)}
+    , root_{std::move(root)}
+  {
+    StateLayout layout;
+    runningOffset_ = layout.claim<bool>();
+    root_->layout(layout, this);
+    initialState_ = std::move(layout.initial);
+    tags_ = std::move(layout.tags);
+  }
+
+  // Whatever the builder creates ends up in one arena, what it drops on the
+  // way included. None of it may outlive the definition.
+  template<class Builder>
+  static std::shared_ptr<const TreeDefinition> build(Builder&& builder)
+  {
+    auto arena = std::make_unique<NodeArena>();
+    NodeArena::Scope scope(*arena);
+    auto root = std::forward<Builder>(builder)();
+    return std::make_shared<const TreeDefinition>(std::move(root), std::move(arena));
+  }
+
+  TreeDefinition(const TreeDefinition&) = delete;
+  TreeDefinition& operator=(const TreeDefinition&) = delete;
+
+  const Node& root() const { return *root_; }
+  const std::vector<std::byte>& initialState() const { return initialState_; }
+  const std::vector<flecs::entity>& tags() const { return tags_; }
+
+  // Does nothing while the previous run has not finished
+  void execute(RunParams params) const
+  {
+    if (!std::exchange(running(params), true))
+      root_->execute(params);
+  }
+
+private:
+  bool& running(RunParams params) const { return *reinterpret_cast<bool*>(params.state + runningOffset_); }
+
+  void succeeded(RunParams params, const Node*) const override { running(params) = false; }
+  void failed(RunParams params, const Node*) const override { running(params) = false; }
+
+private:
+  // Declared first so that it outlives the nodes, which must not outlive the definition
+  std::unique_ptr<NodeArena> arena_;
+  std::unique_ptr<Node> root_;
+  std::uint32_t runningOffset_;
+  std::vector<std::byte> initialState_;
+  std::vector<flecs::entity> tags_;
+};
 
 class BehTree
 {
 public:
   BehTree() = default;
 
-  BehTree(flecs::entity entity, std::unique_ptr<Node> root)
-    : root_{std::move(root)}
-  {
-    struct Callback : INodeCaller
-    {
-      void succeeded(RunParams, Node*) override
-      {
-        e.get([](BehTree& tree)
-          {
-            tree.running_ = false;
-          });
-      }
-
-      void failed(RunParams, Node*) override
-      {
-        e.get([](BehTree& tree)
-          {
-            tree.running_ = false;
-          });
-      }
-
-      flecs::entity e;
-    };
-
-    auto cb = std::make_unique<Callback>();
-    cb->e = entity;
-    callback_ = std::move(cb);
-
-    root_->connect(entity, callback_.get());
+  // Only the tree, the entity is expected to get the rest from an agent prefab
+  explicit BehTree(std::shared_ptr<const TreeDefinition> definition)
+    : definition_{std::move(definition)}
+    , state_{definition_->initialState()}
+  {
+  }
+
+  BehTree(flecs::entity entity, std::shared_ptr<const TreeDefinition> definition)
+    : BehTree(std::move(definition))
+  {
+    for (auto tag : definition_->tags())
+      entity.add(tag);
     entity.set<EventList>({})
       .set<Blackboard>({})
       .set<ActingNodes>({})
       .set<ReactingNodes>({});
   }
 
-  BehTree(BehTree&&) = default;
-  BehTree& operator=(BehTree&&) = default;
-  BehTree(const BehTree&) = default;
-  BehTree& operator=(const BehTree&) = default;
+  BehTree(flecs::entity entity, std::unique_ptr<Node> root)
+    : BehTree(entity, std::make_shared<const TreeDefinition>(std::move(root)))
+  {
+  }
+
+  void drawDebug(flecs::entity entity) const
+  {
+    if (definition_)
+      definition_->root().debugDraw(entity, state_.data());
+  }
 
-  void drawDebug() const
+  // Shares the definition, only the state gets copied
+  BehTree copy_to(flecs::entity entity) const
   {
-    root_->debugDraw();
+    return BehTree(entity, definition_);
   }
 
-  BehTree copy_to(flecs::entity entity)
+  RunParams params(flecs::entity entity)
   {
-    return BehTree(entity, root_->clone());
+    return {entity, state_.data()};
   }
 
-  void execute(RunParams params)
+  void execute(flecs::entity entity)
   {
-    if (!std::exchange(running_, true) && root_)
-      root_->execute(params);
+    if (definition_)
+      definition_->execute(params(entity));
   }
 
 private:
-  bool running_ = false;
-  // Flecs staging requires copies :(
-  std::shared_ptr<INodeCaller> callback_;
-  std::shared_ptr<Node> root_;
+  std::shared_ptr<const TreeDefinition> definition_;
+  std::vector<std::byte> state_;
 };
 
+// Carries everything an agent needs to run the definition: the tree, the
+// support components and the event tags. Instances get their own copies of
+// the components, so one prefab serves a whole wave of spawns.
+flecs::entity make_agent_prefab(flecs::world& world, std::shared_ptr<const TreeDefinition> definition);
+
+// Starts the prefab's tree on every entity, each one moves tables once
+// instead of once per support component
+void instantiate(std::span<const flecs::entity> agents, flecs::entity prefab);
+
+// Creates `count` agents at once, straight into their final table. Can't
+// be used while the world is deferred, e.g. from systems.
+std::vector<flecs::entity> spawn_agents(flecs::world& world, flecs::entity prefab, std::int32_t count);
+
 std::unique_ptr<Node> sequence(std::vector<std::unique_ptr<Node>> nodes);
 std::unique_ptr<Node> select(std::vector<std::unique_ptr<Node>> nodes);
 std::unique_ptr<Node> utility_select(std::vector<std::pair<std::unique_ptr<Node>, fu2::function<float(const Blackboard&) const>>> nodes);
@@ -212,7 +359,7 @@ std::unique_ptr<Node> get_pair_target(std::string_view bb_from, flecs::entity re
 template<class T>
 std::unique_ptr<Node> broadcast(flecs::query_builder<Blackboard> query, std::string_view bb_name);
 template<class T>
-std::unique_ptr<Node> calculate(fu2::function<std::optional<T>(flecs::entity, const Blackboard&)> func, std::string_view bb_to);
+std::unique_ptr<Node> calculate(fu2::function<std::optional<T>(flecs::entity, const Blackboard&) const> func, std::string_view bb_to);
 
 } // namespace beh_tree
 
@@ -9,7 +9,7 @@ namespace beh_tree
 namespace detail
 {
 
-std::unique_ptr<Node> predicate_internal(fu2::function<bool(flecs::entity)> pred, std::unique_ptr<Node> execute);
+std::unique_ptr<Node> predicate_internal(fu2::function<bool(flecs::entity) const> pred, std::unique_ptr<Node> execute);
 
 template<class Pred, class = decltype(&Pred::operator())>
 struct PredWrapper;
@@ -49,10 +49,10 @@ std::unique_ptr<Node> broadcast(flecs::query_builder<Blackboard> query, std::str
     {
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
       bool error = false;
-      auto myBb = this->entity_.template get<Blackboard>();
+      auto myBb = params.entity.template get<Blackboard>();
       targets.each(
         [myBb, this, &error](Blackboard& bb)
         {
@@ -77,26 +77,26 @@ std::unique_ptr<Node> broadcast(flecs::query_builder<Blackboard> query, std::str
 
 template<class T>
 std::unique_ptr<Node> calculate(
-  fu2::function<std::optional<T>(flecs::entity, const Blackboard&)> func, std::string_view bb_to)
+  fu2::function<std::optional<T>(flecs::entity, const Blackboard&) const> func, std::string_view bb_to)
 {
   struct CalculateNode : InstantActionNode<CalculateNode>
   {
-    fu2::function<std::optional<T>(flecs::entity, const Blackboard&)> function;
+    fu2::function<std::optional<T>(flecs::entity, const Blackboard&) const> function;
     size_t bbVariable;
 
-    CalculateNode(fu2::function<std::optional<T>(flecs::entity, const Blackboard&)> func, std::string_view bb_name)
+    CalculateNode(fu2::function<std::optional<T>(flecs::entity, const Blackboard&) const> func, std::string_view bb_name)
       : function{std::move(func)}
       , bbVariable{Blackboard::getId(bb_name)}
     {
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
       bool error = false;
-      this->entity_.template get(
-        [&error, this](Blackboard& bb)
+      params.entity.template get(
+        [&error, this, params](Blackboard& bb)
         {
-          auto val = function(this->entity_, bb);
+          auto val = function(params.entity, bb);
           error = !val.has_value();
           if (!error)
             bb.set(bbVariable, *val);
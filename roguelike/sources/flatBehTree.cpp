@@ -0,0 +1,341 @@
+#include <flatBehTree.hpp>
+
+#include <random>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+
+#include <assert.hpp>
+
+
+namespace beh_tree::flat
+{
+
+FlatTree::FlatTree(NodeDesc root)
+{
+  StateLayout layout;
+  StateLayout persistent;
+  compile(root, layout, persistent);
+
+  // Persistent state goes past everything reset can reach
+  resetSize_ = std::uint32_t(layout.initial.size());
+  const auto base = std::uint32_t(
+    (layout.initial.size() + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t));
+  layout.initial.resize(base);
+  layout.initial.insert(layout.initial.end(), persistent.initial.begin(), persistent.initial.end());
+  for (auto& us : utilityStates_)
+    us.biases += base;
+
+  initialState_ = std::move(layout.initial);
+  tags_ = std::move(layout.tags);
+}
+
+std::uint32_t FlatTree::compile(NodeDesc& desc, StateLayout& layout, StateLayout& persistent)
+{
+  const auto index = std::uint32_t(nodes_.size());
+  const auto childCount = std::uint32_t(desc.children.size());
+  // A subtree's state is everything claimed from here until the next subtree starts
+  FlatNode node{.kind = desc.kind, .childCount = childCount, .state = std::uint32_t(layout.initial.size())};
+
+  switch (desc.kind)
+  {
+  case NodeKind::Sequence:
+  case NodeKind::Select:
+    node.state = layout.claim<std::uint32_t>();
+    break;
+  case NodeKind::UtilitySelect:
+    node.payload = std::uint32_t(utilityStates_.size());
+    utilityStates_.push_back(
+      {
+        .firstUtility = std::uint32_t(utilities_.size()),
+        // Like in the node runtime, biases outlive the select getting cancelled
+        .biases = persistent.claim<float>(childCount),
+        .weights = layout.claim<float>(childCount),
+        .left = layout.claim<bool>(childCount),
+        .picks = layout.claim<float>(childCount),
+        .current = layout.claim<std::uint32_t>(),
+      });
+    node.state = utilityStates_.back().weights;
+    std::move(desc.utilities.begin(), desc.utilities.end(), std::back_inserter(utilities_));
+    break;
+  case NodeKind::Parallel:
+    node.state = layout.claim<Status>(childCount, Status::Running);
+    break;
+  case NodeKind::Predicate:
+    node.payload = std::uint32_t(predicates_.size());
+    predicates_.push_back(std::move(desc.predicate));
+    node.state = layout.claim<bool>();
+    break;
+  case NodeKind::WaitEvent:
+    node.payload = std::uint32_t(events_.size());
+    events_.push_back(desc.event);
+    // Lets the event dispatchers know the agent cares
+    layout.tags.push_back(desc.event);
+    break;
+  case NodeKind::Action:
+    node.payload = std::uint32_t(actions_.size());
+    actions_.push_back(std::move(desc.action));
+    break;
+  case NodeKind::Race:
+  case NodeKind::Repeat:
+    break;
+  }
+
+  NG_ASSERT((desc.kind != NodeKind::Repeat && desc.kind != NodeKind::Predicate) || childCount == 1);
+
+  nodes_.push_back(node);
+  for (auto& child : desc.children)
+    compile(child, layout, persistent);
+  nodes_[index].end = std::uint32_t(nodes_.size());
+  return index;
+}
+
+Status FlatTree::tick(flecs::entity entity, Blackboard& bb, const EventList& evs, std::byte* state) const
+{
+  return run(0, Context{entity, bb, evs, state});
+}
+
+void FlatTree::reset(std::uint32_t index, const Context& ctx) const
+{
+  const std::uint32_t from = nodes_[index].state;
+  const std::uint32_t to = nodes_[index].end < nodes_.size()
+    ? nodes_[nodes_[index].end].state
+    : resetSize_;
+  std::memcpy(ctx.state + from, initialState_.data() + from, to - from);
+}
+
+std::uint32_t FlatTree::pickChild(std::uint32_t index, const Context& ctx) const
+{
+  static std::default_random_engine eng;
+
+  const FlatNode& node = nodes_[index];
+  const UtilityState& us = utilityStates_[node.payload];
+  auto biases = at<float>(ctx, us.biases);
+  auto weights = at<float>(ctx, us.weights);
+  auto left = at<bool>(ctx, us.left);
+
+  auto pick = at<float>(ctx, us.picks);
+  for (std::uint32_t i = 0; i < node.childCount; ++i)
+    pick[i] = left[i] ? std::max(0.f, weights[i] - biases[i]) : 0.f;
+
+  // Children that already ran have no weight, when nothing left has any the first one goes.
+  // Walks the cumulative weights by hand, discrete_distribution would allocate.
+  std::uint32_t picked;
+  const float total = std::accumulate(pick, pick + node.childCount, 0.f);
+  if (total > 0)
+  {
+    float roll = std::uniform_real_distribution<float>(0.f, total)(eng);
+    picked = 0;
+    for (std::uint32_t i = 0; i < node.childCount; ++i)
+      if (pick[i] > 0)
+      {
+        // The last weighted child also takes what rounding leaves over
+        picked = i;
+        if (roll < pick[i])
+          break;
+        roll -= pick[i];
+      }
+  }
+  else
+    picked = std::uint32_t(std::find(left, left + node.childCount, true) - left);
+  biases[picked] += UTILITY_BIAS_INCREASE;
+  left[picked] = false;
+
+  std::uint32_t child = index + 1;
+  for (std::uint32_t i = 0; i < picked; ++i)
+    child = nodes_[child].end;
+  return child;
+}
+
+Status FlatTree::run(std::uint32_t index, const Context& ctx) const
+{
+  const FlatNode& node = nodes_[index];
+  switch (node.kind)
+  {
+  case NodeKind::Sequence:
+  case NodeKind::Select:
+  {
+    // Sequences go on while children succeed, selects while they fail
+    const Status carryOn = node.kind == NodeKind::Sequence ? Status::Succeeded : Status::Failed;
+    auto& current = *at<std::uint32_t>(ctx, node.state);
+    for (std::uint32_t child = current ? current : index + 1; child < node.end; child = nodes_[child].end)
+    {
+      const Status status = run(child, ctx);
+      if (status == Status::Running)
+      {
+        current = child;
+        return status;
+      }
+      if (status != carryOn)
+      {
+        current = 0;
+        return status;
+      }
+    }
+    current = 0;
+    return carryOn;
+  }
+
+  case NodeKind::UtilitySelect:
+  {
+    if (node.childCount == 0)
+      return Status::Failed;
+
+    const UtilityState& us = utilityStates_[node.payload];
+    auto left = at<bool>(ctx, us.left);
+    auto& current = *at<std::uint32_t>(ctx, us.current);
+    if (current == 0)
+    {
+      auto biases = at<float>(ctx, us.biases);
+      auto weights = at<float>(ctx, us.weights);
+      for (std::uint32_t i = 0; i < node.childCount; ++i)
+      {
+        biases[i] = biases[i] > UTILITY_BIAS_DECREASE ? biases[i] - UTILITY_BIAS_DECREASE : 0;
+        weights[i] = utilities_[us.firstUtility + i](ctx.bb) + biases[i];
+        left[i] = true;
+      }
+      current = pickChild(index, ctx);
+    }
+
+    for (;;)
+    {
+      const Status status = run(current, ctx);
+      if (status == Status::Running)
+        return status;
+      if (status == Status::Succeeded || std::none_of(left, left + node.childCount, [](bool l) { return l; }))
+      {
+        std::fill_n(left, node.childCount, false);
+        current = 0;
+        return status;
+      }
+      current = pickChild(index, ctx);
+    }
+  }
+
+  case NodeKind::Parallel:
+  {
+    auto statuses = at<Status>(ctx, node.state);
+    bool finished = true;
+    for (std::uint32_t i = 0, child = index + 1; i < node.childCount; ++i, child = nodes_[child].end)
+    {
+      if (statuses[i] != Status::Running)
+        continue;
+      statuses[i] = run(child, ctx);
+      if (statuses[i] == Status::Failed)
+      {
+        reset(index, ctx);
+        return Status::Failed;
+      }
+      finished = finished && statuses[i] == Status::Succeeded;
+    }
+    if (!finished)
+      return Status::Running;
+    std::fill_n(statuses, node.childCount, Status::Running);
+    return Status::Succeeded;
+  }
+
+  case NodeKind::Race:
+    for (std::uint32_t child = index + 1; child < node.end; child = nodes_[child].end)
+      if (const Status status = run(child, ctx); status != Status::Running)
+      {
+        reset(index, ctx);
+        return status;
+      }
+    return Status::Running;
+
+  case NodeKind::Repeat:
+    return run(index + 1, ctx) == Status::Failed ? Status::Failed : Status::Running;
+
+  case NodeKind::Predicate:
+  {
+    auto& entered = *at<bool>(ctx, node.state);
+    if (!entered && !predicates_[node.payload](ctx.entity))
+      return Status::Failed;
+    const Status status = run(index + 1, ctx);
+    entered = status == Status::Running;
+    return status;
+  }
+
+  case NodeKind::WaitEvent:
+    return ctx.evs.events.contains(events_[node.payload]) ? Status::Succeeded : Status::Running;
+
+  case NodeKind::Action:
+    return actions_[node.payload](ctx.entity, ctx.bb);
+  }
+
+  NG_ASSERT(false);
+  return Status::Failed;
+}
+
+static NodeDesc compound(NodeKind kind, std::vector<NodeDesc> nodes)
+{
+  NodeDesc result{.kind = kind};
+  result.children = std::move(nodes);
+  return result;
+}
+
+NodeDesc sequence(std::vector<NodeDesc> nodes)
+{
+  return compound(NodeKind::Sequence, std::move(nodes));
+}
+
+NodeDesc select(std::vector<NodeDesc> nodes)
+{
+  return compound(NodeKind::Select, std::move(nodes));
+}
+
+NodeDesc utility_select(std::vector<std::pair<NodeDesc, UtilityFunc>> nodes)
+{
+  NodeDesc result{.kind = NodeKind::UtilitySelect};
+  result.children.reserve(nodes.size());
+  result.utilities.reserve(nodes.size());
+  for (auto&[node, func] : nodes)
+  {
+    result.children.push_back(std::move(node));
+    result.utilities.push_back(std::move(func));
+  }
+  return result;
+}
+
+NodeDesc parallel(std::vector<NodeDesc> nodes)
+{
+  return compound(NodeKind::Parallel, std::move(nodes));
+}
+
+NodeDesc race(std::vector<NodeDesc> nodes)
+{
+  return compound(NodeKind::Race, std::move(nodes));
+}
+
+NodeDesc repeat(NodeDesc node)
+{
+  NodeDesc result{.kind = NodeKind::Repeat};
+  result.children.push_back(std::move(node));
+  return result;
+}
+
+NodeDesc wait_event(flecs::entity event)
+{
+  NodeDesc result{.kind = NodeKind::WaitEvent};
+  result.event = event;
+  return result;
+}
+
+NodeDesc action(ActionFunc func)
+{
+  NodeDesc result{.kind = NodeKind::Action};
+  result.action = std::move(func);
+  return result;
+}
+
+NodeDesc fail()
+{
+  return action([](flecs::entity, Blackboard&) { return Status::Failed; });
+}
+
+NodeDesc succeed()
+{
+  return action([](flecs::entity, Blackboard&) { return Status::Succeeded; });
+}
+
+} // namespace beh_tree::flat
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include <function2/function2.hpp>
+
+#include <behTree.hpp>
+
+
+// Second runtime for behaviour trees: the tree gets compiled into one array
+// of nodes in depth-first order and ticked by a switch over node kinds, no
+// virtual calls and no pointers between nodes. Leaves get polled every tick
+// instead of calling back, so nothing has to be registered or cancelled.
+namespace beh_tree::flat
+{
+
+enum class Status : std::uint8_t
+{
+  Running,
+  Succeeded,
+  Failed,
+};
+
+using ActionFunc = fu2::function<Status(flecs::entity, Blackboard&) const>;
+using UtilityFunc = fu2::function<float(const Blackboard&) const>;
+
+enum class NodeKind : std::uint8_t
+{
+  Sequence,
+  Select,
+  UtilitySelect,
+  Parallel,
+  Race,
+  Repeat,
+  Predicate,
+  WaitEvent,
+  Action,
+};
+
+// What the combinators below build, only lives until it gets compiled
+struct NodeDesc
+{
+  NodeKind kind;
+  std::vector<NodeDesc> children;
+  fu2::function<bool(flecs::entity) const> predicate;
+  std::vector<UtilityFunc> utilities;
+  flecs::entity event;
+  ActionFunc action;
+};
+
+class FlatTree
+{
+public:
+  explicit FlatTree(NodeDesc root);
+
+  FlatTree(const FlatTree&) = delete;
+  FlatTree& operator=(const FlatTree&) = delete;
+
+  // Runs the tree until every branch either finished or is waiting.
+  // Finished trees start over on the next tick.
+  Status tick(flecs::entity entity, Blackboard& bb, const EventList& evs, std::byte* state) const;
+
+  const std::vector<std::byte>& initialState() const { return initialState_; }
+  const std::vector<flecs::entity>& tags() const { return tags_; }
+  std::size_t size() const { return nodes_.size(); }
+
+private:
+  struct FlatNode
+  {
+    NodeKind kind;
+    // Children are [index + 1, end), the next one starts where the previous one ends
+    std::uint32_t end;
+    std::uint32_t childCount;
+    std::uint32_t state;
+    // Into the array of whatever the kind needs
+    std::uint32_t payload;
+  };
+
+  // Where a utility select keeps its per-child arrays
+  struct UtilityState
+  {
+    std::uint32_t firstUtility;
+    std::uint32_t biases;
+    std::uint32_t weights;
+    std::uint32_t left;
+    // Scratch for the weights of a single pick
+    std::uint32_t picks;
+    // Node index of the running child, 0 when not running
+    std::uint32_t current;
+  };
+
+  struct Context
+  {
+    flecs::entity entity;
+    Blackboard& bb;
+    const EventList& evs;
+    std::byte* state;
+  };
+
+  // Persistent state is left alone by reset
+  std::uint32_t compile(NodeDesc& desc, StateLayout& layout, StateLayout& persistent);
+  Status run(std::uint32_t index, const Context& ctx) const;
+  std::uint32_t pickChild(std::uint32_t index, const Context& ctx) const;
+  // Puts a subtree back the way it was before it ran
+  void reset(std::uint32_t index, const Context& ctx) const;
+
+  template<class T>
+  static T* at(const Context& ctx, std::uint32_t offset)
+  {
+    return std::launder(reinterpret_cast<T*>(ctx.state + offset));
+  }
+
+private:
+  std::vector<FlatNode> nodes_;
+  std::vector<ActionFunc> actions_;
+  std::vector<fu2::function<bool(flecs::entity) const>> predicates_;
+  std::vector<UtilityFunc> utilities_;
+  std::vector<UtilityState> utilityStates_;
+  std::vector<flecs::entity> events_;
+  std::vector<std::byte> initialState_;
+  // Everything before this gets reset, the persistent state comes after it
+  std::uint32_t resetSize_{0};
+  std::vector<flecs::entity> tags_;
+};
+
+// Component, same deal as BehTree: a shared tree and a state block per agent
+class FlatBehTree
+{
+public:
+  FlatBehTree() = default;
+
+  FlatBehTree(flecs::entity entity, std::shared_ptr<const FlatTree> tree)
+    : tree_{std::move(tree)}
+    , state_{tree_->initialState()}
+  {
+    for (auto tag : tree_->tags())
+      entity.add(tag);
+    entity.set<EventList>({})
+      .set<Blackboard>({});
+  }
+
+  Status tick(flecs::entity entity, Blackboard& bb, const EventList& evs)
+  {
+    return tree_ ? tree_->tick(entity, bb, evs, state_.data()) : Status::Failed;
+  }
+
+private:
+  std::shared_ptr<const FlatTree> tree_;
+  std::vector<std::byte> state_;
+};
+
+NodeDesc sequence(std::vector<NodeDesc> nodes);
+NodeDesc select(std::vector<NodeDesc> nodes);
+NodeDesc utility_select(std::vector<std::pair<NodeDesc, UtilityFunc>> nodes);
+NodeDesc parallel(std::vector<NodeDesc> nodes);
+// First child to finish decides the overall result
+NodeDesc race(std::vector<NodeDesc> nodes);
+// Runs a node again on the next tick until it fails
+NodeDesc repeat(NodeDesc node);
+
+template<class Pred>
+NodeDesc predicate(Pred pred, NodeDesc execute)
+{
+  NodeDesc result{.kind = NodeKind::Predicate};
+  result.predicate = beh_tree::detail::PredWrapper<Pred>{std::move(pred)};
+  result.children.push_back(std::move(execute));
+  return result;
+}
+
+NodeDesc wait_event(flecs::entity event);
+// Called every tick until it returns something else than Running
+NodeDesc action(ActionFunc func);
+NodeDesc fail();
+NodeDesc succeed();
+
+} // namespace beh_tree::flat
@@ -1,21 +1,61 @@
 #include "aiSystems.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <random>
 
 #include <fmt/format.h>
 
 #include <behTree.hpp>
+#include <flatBehTree.hpp>
 #include <variant>
 #include "blackboard.hpp"
 #include "components.hpp"
 #include "actions.hpp"
 #include "gameplay/dungeon/dmaps.hpp"
+#include "gameplay/dungeon/dungeonUtils.hpp"
+#include "gameplay/dungeon/fov.hpp"
+#include "gameplay/dungeon/pathfinding.hpp"
 
 
 struct SimulateAi {};
 
+// Scratch SoA buffers for batched smart movement resolution,
+// reused between runs so that resolution does not allocate.
+struct SmartMovementBatch
+{
+  static constexpr std::size_t DIRS = 5;
+
+  std::array<std::vector<float>, DIRS> weights;
+  std::array<std::vector<float>, DIRS> samples;
+  std::vector<float> coefficients;
+  std::vector<float> bestWeight;
+  std::vector<std::uint8_t> bestDir;
+
+  void resize(std::size_t count)
+  {
+    if (coefficients.size() >= count)
+      return;
+    for (auto& w : weights)
+      w.resize(count);
+    for (auto& s : samples)
+      s.resize(count);
+    coefficients.resize(count);
+    bestWeight.resize(count);
+    bestDir.resize(count);
+  }
+};
+
+// Entities without a field of view see everything
+static bool sees(flecs::entity e, flecs::entity other)
+{
+  auto fov = e.get<dungeon::FieldOfView>();
+  auto pos = other.get<Position>();
+  return !fov || (pos && fov->visible(pos->v));
+}
+
 SimulateAiInfo register_ai_systems(flecs::world& world)
 {
   auto eventsPhase = world.entity("ai_events_phase").add<SimulateAi>();
@@ -26,9 +66,9 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
     ("beh_tree_execute")
     .kind(eventsPhase)
     .each(
-      [](beh_tree::BehTree& tree, Blackboard&, beh_tree::ActingNodes&, beh_tree::ReactingNodes&)
+      [](flecs::entity e, beh_tree::BehTree& tree, Blackboard&, beh_tree::ActingNodes&, beh_tree::ReactingNodes&)
       {
-        tree.execute({});
+        tree.execute(e);
       });
 
   auto enemyNearEvent = world.entity("enemy_near");
@@ -41,7 +81,11 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
       (flecs::entity e, EventList& evs)
       {
         // Could be optimized by using `iter`
-        if (!e.has<ClosestVisibleEnemy, NoVisibleEntity>())
+        if (e.has<ClosestVisibleEnemy, NoVisibleEntity>())
+          return;
+
+        auto enemy = e.target<ClosestVisibleEnemy>();
+        if (enemy.is_alive() && sees(e, enemy))
           evs.events.emplace(enemyNearEvent);
       });
 
@@ -55,7 +99,11 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
       (flecs::entity e, EventList& evs)
       {
         // Could be optimized by using `iter`
-        if (!e.has<ClosestVisibleAlly, NoVisibleEntity>())
+        if (e.has<ClosestVisibleAlly, NoVisibleEntity>())
+          return;
+
+        auto ally = e.target<ClosestVisibleAlly>();
+        if (ally.is_alive() && sees(e, ally))
           evs.events.emplace(allyNearEvent);
       });
 
@@ -132,13 +180,22 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
     .term<beh_tree::BehTree>().read_write()
     .term<beh_tree::ActingNodes>().read_write()
     .each(
-      [](const EventList& evs,
-        beh_tree::BehTree&, Blackboard&, beh_tree::ActingNodes&, beh_tree::ReactingNodes& reactors)
+      [](flecs::entity e, const EventList& evs,
+        beh_tree::BehTree& tree, Blackboard&, beh_tree::ActingNodes&, beh_tree::ReactingNodes& reactors)
       {
         auto copy = reactors.eventReactors;
         for (auto[ev, node] : copy)
           if (evs.events.contains(ev))
-            node->act({});
+            node->act(tree.params(e));
+      });
+
+  // Polls its leaves instead of waiting for callbacks, so it ticks while the events are still there
+  world.system<beh_tree::flat::FlatBehTree, Blackboard, const EventList>("flat_beh_tree_tick")
+    .kind(eventsPhase)
+    .each(
+      [](flecs::entity e, beh_tree::flat::FlatBehTree& tree, Blackboard& bb, const EventList& evs)
+      {
+        tree.tick(e, bb, evs);
       });
 
 
@@ -152,11 +209,11 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
     .kind(stateReactionPhase)
     .term<Action>().read_write()
     .each(
-      [](beh_tree::BehTree&, Blackboard&, beh_tree::ActingNodes& actors, beh_tree::ReactingNodes&)
+      [](flecs::entity e, beh_tree::BehTree& tree, Blackboard&, beh_tree::ActingNodes& actors, beh_tree::ReactingNodes&)
       {
         auto copy = actors.actingNodes;
         for (auto node : copy)
-          node->act({});
+          node->act(tree.params(e));
       });
 
   auto createReactor =
@@ -170,35 +227,146 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
         .term(state).optional().read();
     };
 
-  world.system<Action, const Position, const Blackboard, const SmartMovement>("resolve smart movement")
-    .kind(stateReactionPhase)
+  world.observer<const SmartMovement>("compile smart movement")
+    .event(flecs::OnSet)
+    .each(
+      [](flecs::entity e, const SmartMovement& movement)
+      {
+        // Every level has its own dmaps, the names are relative to it
+        auto level = dungeon::dungeon_of(e);
+        CompiledSmartMovement compiled;
+        compiled.potential.reserve(movement.potential.size());
+        for (auto&[dmapName, coeff, bbCoeffName, power] : movement.potential)
+        {
+          auto dmapEntity = level.lookup(dmapName.c_str());
+          NG_ASSERT(dmapEntity);
+          auto dmap = dmapEntity.get<dungeon::dmaps::Dmap>();
+          NG_ASSERT(dmap);
+          dungeon::dmaps::acquire(dmapEntity);
+          compiled.potential.push_back(
+            {
+              .dmapEntity = dmapEntity,
+              .dmap = dmap->view,
+              .coefficient = coeff,
+              .bbVariableCoefficient = bbCoeffName.empty()
+                ? std::nullopt : std::optional{Blackboard::getId(bbCoeffName)},
+              .power = power,
+            });
+        }
+
+        // Release only after acquiring so that shared dmaps never go dormant
+        if (auto old = e.get<CompiledSmartMovement>())
+          for (auto& summand : old->potential)
+            dungeon::dmaps::release(summand.dmapEntity);
+
+        e.set(std::move(compiled));
+      });
+
+  world.observer<const SmartMovement>("discard compiled smart movement")
+    .event(flecs::OnRemove)
     .each(
-      [](flecs::entity e, Action& action, Position pos, const Blackboard& bb, const SmartMovement& movement)
+      [](flecs::entity e, const SmartMovement&)
       {
-        std::array<float, 5> neighborWeights{};
-        const std::array<ActionType, 5> neighborDir
+        e.remove<CompiledSmartMovement>();
+      });
+
+  // Also fires when the entity dies
+  world.observer<const CompiledSmartMovement>()
+    .event(flecs::OnRemove)
+    .each(
+      [](const CompiledSmartMovement& movement)
+      {
+        for (auto& summand : movement.potential)
+          dungeon::dmaps::release(summand.dmapEntity);
+      });
+
+  static SmartMovementBatch smartMovementBatch;
+
+  // Agents are scored in batches: dmap samples get gathered into SoA buffers
+  // (the only part that touches memory randomly) and the weighted sums and
+  // argmin are then evaluated in branchless loops the compiler vectorizes.
+  world.system<Action, const Position, const Blackboard, const CompiledSmartMovement>("resolve smart movement")
+    .kind(stateReactionPhase)
+    .iter(
+      [](flecs::iter& it, Action* action, const Position* pos,
+        const Blackboard* bb, const CompiledSmartMovement* movement)
+      {
+        constexpr std::size_t DIRS = SmartMovementBatch::DIRS;
+        constexpr float INF = dungeon::dmaps::INF;
+        static constexpr std::array<ActionType, DIRS> neighborDir
           {ActionType::NOP, ActionType::MOVE_UP, ActionType::MOVE_DOWN, ActionType::MOVE_LEFT, ActionType::MOVE_RIGHT};
-        for (size_t i = 0; i < 5; ++i)
+
+        auto& batch = smartMovementBatch;
+        const std::size_t count = it.count();
+        batch.resize(count);
+
+        std::size_t maxSummands = 0;
+        for (auto i : it)
+          maxSummands = std::max(maxSummands, movement[i].potential.size());
+
+        for (auto& weights : batch.weights)
+          std::fill_n(weights.begin(), count, 0.f);
+
+        for (std::size_t s = 0; s < maxSummands; ++s)
         {
-          auto samplePos = move(pos.v, neighborDir[i]);
-          for (auto&[dmapName, coeff, bbCoeffName, power] : movement.potential)
+          // Gather
+          for (auto i : it)
+          {
+            if (s >= movement[i].potential.size())
+            {
+              batch.coefficients[i] = 0;
+              for (std::size_t d = 0; d < DIRS; ++d)
+                batch.samples[d][i] = 0;
+              continue;
+            }
+
+            auto& summand = movement[i].potential[s];
+            auto maybeBbCoeff = summand.bbVariableCoefficient
+              ? bb[i].get<float>(*summand.bbVariableCoefficient) : std::nullopt;
+            batch.coefficients[i] = (maybeBbCoeff ? *maybeBbCoeff : 1.f) * summand.coefficient;
+
+            for (std::size_t d = 0; d < DIRS; ++d)
+            {
+              auto samplePos = move(pos[i].v, neighborDir[d]);
+              float sample = summand.dmap(samplePos.y, samplePos.x);
+              batch.samples[d][i] = summand.power == 1.f || sample >= INF
+                ? sample : std::pow(sample, summand.power);
+            }
+          }
+
+          // Accumulate, an unreachable sample rules the whole neighbor out
+          const float* coefficients = batch.coefficients.data();
+          for (std::size_t d = 0; d < DIRS; ++d)
           {
-            auto dmapEntity = e.world().lookup(dmapName.c_str());
-            NG_ASSERT(dmapEntity);
-            auto dmap = dmapEntity.get<dungeon::dmaps::Dmap>();
-            NG_ASSERT(dmap);
-            auto sample = dmap->view(samplePos.y, samplePos.x);
-
-            auto maybeBbCoeff = bbCoeffName.empty() ? std::nullopt : bb.get<float>(Blackboard::getId(bbCoeffName));
-
-            if (sample >= dungeon::dmaps::INF)
-              neighborWeights[i] = dungeon::dmaps::INF;
-            else
-              neighborWeights[i] += (maybeBbCoeff ? *maybeBbCoeff : 1.f) * coeff * std::pow(sample, power);
+            float* weights = batch.weights[d].data();
+            const float* samples = batch.samples[d].data();
+            for (std::size_t i = 0; i < count; ++i)
+            {
+              const bool masked = samples[i] >= INF || weights[i] >= INF;
+              const float sum = weights[i] + coefficients[i] * samples[i];
+              weights[i] = masked ? INF : sum;
+            }
           }
         }
-        auto minIdx = std::min_element(neighborWeights.begin(), neighborWeights.end()) - neighborWeights.begin();
-        action.action = neighborDir[minIdx];
+
+        // Argmin, first minimum wins just like std::min_element
+        std::uint8_t* best = batch.bestDir.data();
+        float* bestWeight = batch.bestWeight.data();
+        std::copy_n(batch.weights[0].begin(), count, bestWeight);
+        std::fill_n(best, count, std::uint8_t{0});
+        for (std::size_t d = 1; d < DIRS; ++d)
+        {
+          const float* weights = batch.weights[d].data();
+          for (std::size_t i = 0; i < count; ++i)
+          {
+            const bool less = weights[i] < bestWeight[i];
+            bestWeight[i] = less ? weights[i] : bestWeight[i];
+            best[i] = less ? std::uint8_t(d) : best[i];
+          }
+        }
+
+        for (auto i : it)
+          action[i].action = neighborDir[best[i]];
       });
 
   createReactor.operator()<Action, const Position, const PatrolPos>("patrol")
@@ -232,7 +400,8 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
         if (e.has<ClosestVisibleAlly, NoVisibleEntity>() || !enemy.is_alive())
           return;
 
-        act.action = move_towards(pos.v, enemy.get<Position>()->v);
+        const auto enemyPos = enemy.get<Position>()->v;
+        act.action = move_towards(pos.v, dungeon::next_path_step(e, pos.v, enemy, enemyPos));
       });
 
   createReactor.operator()<Action, const Position>("flee_from_enemy")
@@ -265,12 +434,12 @@ SimulateAiInfo register_ai_systems(flecs::world& world)
   createReactor.operator()<Action, Position>("follow_player")
     .each(
       [playerq = world.query_builder<const Position>().term<IsPlayer>().build()]
-      (Action& act, const Position& pos)
+      (flecs::entity e, Action& act, const Position& pos)
       {
-        playerq.each([&](const Position& ppos)
+        playerq.each([&](flecs::entity player, const Position& ppos)
           {
             if (glm::length(glm::vec2(pos.v) - glm::vec2(ppos.v)) > 2)
-              act.action = move_towards(pos.v, ppos.v);
+              act.action = move_towards(pos.v, dungeon::next_path_step(e, pos.v, player, ppos.v));
           });
       });
 
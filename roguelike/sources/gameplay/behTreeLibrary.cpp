@@ -2,6 +2,10 @@
 
 #include <random>
 #include "actions.hpp"
+#include "dungeon/dungeonUtils.hpp"
+#include "dungeon/spatialIndex.hpp"
+#include "dungeon/fov.hpp"
+#include "dungeon/pathfinding.hpp"
 #include <assert.hpp>
 
 
@@ -9,50 +13,41 @@ namespace beh_tree
 {
 
 std::unique_ptr<Node> get_closest(
-  flecs::query_builder<const Position> query,
-  fu2::function<bool(flecs::entity)> filter,
+  dungeon::TeamSelector teams,
+  fu2::function<bool(flecs::entity) const> filter,
   std::string_view bb_name)
 {
   struct GetClosestNode : ActionNode<GetClosestNode>
   {
-    flecs::query<const Position> query;
-    fu2::function<bool(flecs::entity)> filter;
+    dungeon::TeamSelector teams;
+    // Optional, team selection alone needs no component lookups
+    fu2::function<bool(flecs::entity) const> filter;
     size_t bbVariable;
 
     GetClosestNode(
-      flecs::query_builder<const Position> q,
-      fu2::function<bool(flecs::entity)> f,
+      dungeon::TeamSelector t,
+      fu2::function<bool(flecs::entity) const> f,
       std::string_view bb_name)
-      : query{std::move(q).build()}
+      : teams{t}
       , filter{std::move(f)}
       , bbVariable{Blackboard::getId(bb_name)}
     {
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      auto mypos = entity_.get<Position>()->v;
-      auto vis = entity_.get<Visibility>();
+      auto mypos = params.entity.get<Position>()->v;
+      auto vis = params.entity.get<Visibility>();
+      auto fov = params.entity.get<dungeon::FieldOfView>();
       float visibility = vis ? vis->visibility : std::numeric_limits<float>::max();
 
-      std::optional<flecs::entity> closest;
-      float closest_length = 0;
-      query.each([&](flecs::entity e, const Position& pos)
+      auto& index = *dungeon::dungeon_of(params.entity).get<dungeon::SpatialIndex>();
+      auto closest = index.closest(mypos, visibility, teams,
+        [this, fov](const dungeon::SpatialIndex::Entry& other)
         {
-          if (!filter(e))
-            return;
-
-          float length = glm::length(glm::vec2(mypos - pos.v));
-
-          if (length > visibility)
-            return;
-
-          if (!closest.has_value() || length < closest_length)
-          {
-            closest = e;
-            closest_length = length;
-          }
-        });
+          return (!fov || fov->visible(other.pos)) && (!filter || filter(other.entity));
+        },
+        params.entity.id());
 
       if (!closest.has_value())
       {
@@ -60,17 +55,17 @@ std::unique_ptr<Node> get_closest(
         return;
       }
 
-      entity_.get([this, closest](Blackboard& bb)
+      params.entity.get([this, closest](Blackboard& bb)
         {
-          bb.set(bbVariable, closest.value());
+          bb.set(bbVariable, closest->entity);
         });
       succeed(params);
     }
 
-    void cancelImpl(RunParams) override {}
+    void cancelImpl(RunParams) const override {}
   };
 
-  return std::make_unique<GetClosestNode>(query, std::move(filter), bb_name);
+  return std::make_unique<GetClosestNode>(teams, std::move(filter), bb_name);
 }
 
 std::unique_ptr<Node> move_to(std::string_view bb_name, bool flee)
@@ -86,20 +81,20 @@ std::unique_ptr<Node> move_to(std::string_view bb_name, bool flee)
     {
     }
 
-    void executeImpl(RunParams) override
+    void executeImpl(RunParams params) const override
     {
-      entity_.get([this](ActingNodes& a)
+      params.entity.get([this](ActingNodes& a)
         {
           NG_ASSERT(a.actingNodes.emplace(this).second);
         });
     }
 
-    void act(RunParams params) override
+    void act(RunParams params) const override
     {
       bool success = false;
       bool error = false;
-      entity_.get(
-        [this, &success, &error]
+      params.entity.get(
+        [this, params, &success, &error]
         (Action& action, const Blackboard& bb, const Position& pos)
         {
           auto tgtEntity = bb.get<flecs::entity>(bbVariable);
@@ -124,10 +119,13 @@ std::unique_ptr<Node> move_to(std::string_view bb_name, bool flee)
           {
             success = true;
           }
+          else if (inverse)
+          {
+            action.action = inverse_move(move_towards(pos.v, tgt));
+          }
           else
           {
-            auto dir = move_towards(pos.v, tgt);
-            action.action = inverse ? inverse_move(dir) : dir;
+            action.action = move_towards(pos.v, dungeon::next_path_step(params.entity, pos.v, *tgtEntity, tgt));
           }
         });
 
@@ -143,9 +141,9 @@ std::unique_ptr<Node> move_to(std::string_view bb_name, bool flee)
       }
     }
 
-    void cancelImpl(RunParams) override
+    void cancelImpl(RunParams params) const override
     {
-      entity_.get([this](ActingNodes& a)
+      params.entity.get([this](ActingNodes& a)
         {
           NG_ASSERT(a.actingNodes.erase(this) == 1);
         });
@@ -168,11 +166,11 @@ std::unique_ptr<Node> move_to_once(std::string_view bb_name, bool flee)
     {
     }
 
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
       bool error = false;
-      entity_.get(
-        [this, &error]
+      params.entity.get(
+        [this, params, &error]
         (Action& action, const Blackboard& bb, const Position& pos)
         {
           auto tgtEntity = bb.get<flecs::entity>(bbVariable);
@@ -193,8 +191,9 @@ std::unique_ptr<Node> move_to_once(std::string_view bb_name, bool flee)
 
           auto tgt = tgtPos->v;
 
-          auto dir = move_towards(pos.v, tgt);
-          action.action = inverse ? inverse_move(dir) : dir;
+          action.action = inverse
+            ? inverse_move(move_towards(pos.v, tgt))
+            : move_towards(pos.v, dungeon::next_path_step(params.entity, pos.v, *tgtEntity, tgt));
         });
 
       if (error)
@@ -213,17 +212,17 @@ std::unique_ptr<Node> wander()
 {
   struct WanderNode : InstantActionNode<WanderNode>, IActor
   {
-    void executeImpl(RunParams) override
+    void executeImpl(RunParams params) const override
     {
-      entity_.get([this](ActingNodes& a)
+      params.entity.get([this](ActingNodes& a)
         {
           NG_ASSERT(a.actingNodes.emplace(this).second);
         });
     }
 
-    void act(RunParams) override
+    void act(RunParams params) const override
     {
-      entity_.get(
+      params.entity.get(
         [](Action& action)
         {
           static std::uniform_int_distribution<> dir(0, 3);
@@ -236,9 +235,9 @@ std::unique_ptr<Node> wander()
         });
     }
 
-    void cancelImpl(RunParams) override
+    void cancelImpl(RunParams params) const override
     {
-      entity_.get([this](ActingNodes& a)
+      params.entity.get([this](ActingNodes& a)
         {
           NG_ASSERT(a.actingNodes.erase(this) == 1);
         });
@@ -252,9 +251,9 @@ std::unique_ptr<Node> wander_once()
 {
   struct WanderOnceNode : InstantActionNode<WanderOnceNode>
   {
-    void executeImpl(RunParams params) override
+    void executeImpl(RunParams params) const override
     {
-      entity_.get(
+      params.entity.get(
         [](Action& action)
         {
           static std::uniform_int_distribution<> dir(0, 3);
@@ -2,42 +2,39 @@
 
 #include <behTree.hpp>
 #include "components.hpp"
+#include "dungeon/spatialIndex.hpp"
 
 
 namespace beh_tree
 {
   
-// Accounts for visibility component if present
+// Accounts for visibility component if present, never picks the entity itself
 std::unique_ptr<Node> get_closest(
-  flecs::query_builder<const Position> query,
-  fu2::function<bool(flecs::entity)> filter,
+  dungeon::TeamSelector teams,
+  fu2::function<bool(flecs::entity) const> filter,
   std::string_view bb_name);
 
 inline std::unique_ptr<Node> get_closest(
-  flecs::query_builder<const Position> query,
+  fu2::function<bool(flecs::entity) const> filter,
   std::string_view bb_name)
 {
-  return get_closest(query, [](flecs::entity) { return true; }, bb_name);
+  return get_closest(dungeon::TeamSelector::any(), std::move(filter), bb_name);
+}
+
+template<class... Comps>
+std::unique_ptr<Node> get_closest_with(std::string_view bb_name)
+{
+  return get_closest([](flecs::entity e) { return (e.has<Comps>() && ...); }, bb_name);
 }
 
 inline std::unique_ptr<Node> get_closest_enemy(flecs::entity e, std::string_view bb_name)
 {
-  return get_closest(e.world().query_builder<const Position>().term<Team>(),
-    [team = e.get<Team>()->team](flecs::entity candidate)
-    {
-      return candidate.get<Team>()->team != team;
-    },
-    bb_name);
+  return get_closest(dungeon::TeamSelector::except(e.get<Team>()->team), {}, bb_name);
 }
 
 inline std::unique_ptr<Node> get_closest_ally(flecs::entity e, std::string_view bb_name)
 {
-  return get_closest(e.world().query_builder<const Position>().term<Team>(),
-    [team = e.get<Team>()->team](flecs::entity candidate)
-    {
-      return candidate.get<Team>()->team == team;
-    },
-    bb_name);
+  return get_closest(dungeon::TeamSelector::only(e.get<Team>()->team), {}, bb_name);
 }
 
 std::unique_ptr<Node> move_to(std::string_view bb_name, bool flee = false);
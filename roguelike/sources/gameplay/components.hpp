@@ -8,6 +8,7 @@
 #include <glm/glm.hpp>
 
 #include <sprite.hpp>
+#include "gameplay/dungeon/dmaps.hpp"
 
 
 struct MovePos
@@ -95,6 +96,7 @@ struct SmartMovement
 {
   struct Summand
   {
+    // One of the dmaps of the level the entity is on
     std::string dmap;
     float coefficient{1.f};
     std::string bbVariableCoefficient;
@@ -103,3 +105,20 @@ struct SmartMovement
 
   std::vector<Summand> potential;
 };
+
+// Produced from SmartMovement by an observer, so that sampling
+// does not need to look up dmaps and blackboard variables by name.
+// Dmap views stay valid because dmaps are never re-created.
+struct CompiledSmartMovement
+{
+  struct Summand
+  {
+    flecs::entity dmapEntity;
+    dungeon::dmaps::DmapView dmap;
+    float coefficient{1.f};
+    std::optional<size_t> bbVariableCoefficient;
+    float power{1};
+  };
+
+  std::vector<Summand> potential;
+};
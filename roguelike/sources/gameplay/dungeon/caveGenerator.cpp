@@ -0,0 +1,425 @@
+#include "dungeonGenerator.hpp"
+#include "workerPool.hpp"
+#include <bit>
+#include <span>
+#include <array>
+#include <vector>
+#include <numeric>
+#include <cstring>
+#include <algorithm>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+// One bit per tile, bit x of a row is tile x, set for floor
+struct Bitboard
+{
+  int width;
+  int height;
+  int wordsPerRow;
+  std::vector<std::uint64_t> words;
+
+  std::uint64_t* row(int y) { return words.data() + std::size_t(y) * wordsPerRow; }
+  const std::uint64_t* row(int y) const { return words.data() + std::size_t(y) * wordsPerRow; }
+
+  bool floor(int x, int y) const { return (row(y)[x / 64] >> (x % 64)) & 1; }
+  void dig(int x, int y) { row(y)[x / 64] |= std::uint64_t{1} << (x % 64); }
+  void fill(int x, int y) { row(y)[x / 64] &= ~(std::uint64_t{1} << (x % 64)); }
+};
+
+std::uint64_t splitmix(std::uint64_t& state)
+{
+  std::uint64_t z = (state += 0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
+
+// Bands of rows the board gets split into, small maps stay on the calling thread
+std::size_t band_count(const Bitboard& board, WorkerPool* workers)
+{
+  constexpr std::size_t minWordsPerBand = 1 << 13;
+  return workers ? std::clamp<std::size_t>(board.words.size() / minWordsPerBand, 1, workers->size()) : 1;
+}
+
+// Calls fn(band, begin, end) for every band of rows [begin, end), in parallel when there are several
+template<typename Fn>
+void for_bands(const Bitboard& board, WorkerPool* workers, Fn&& fn)
+{
+  const std::size_t bands = band_count(board, workers);
+  if (bands == 1)
+  {
+    fn(std::size_t{0}, 0, board.height);
+    return;
+  }
+
+  workers->run(
+    [&](std::size_t worker)
+    {
+      if (worker < bands)
+        fn(worker, int(board.height * worker / bands), int(board.height * (worker + 1) / bands));
+    });
+}
+
+// Tiles that may be floor in a row, everything but the border
+std::vector<std::uint64_t> inner_mask(int width, int wordsPerRow)
+{
+  std::vector<std::uint64_t> result(wordsPerRow, 0);
+  for (int x = 1; x < width - 1; ++x)
+    result[x / 64] |= std::uint64_t{1} << (x % 64);
+  return result;
+}
+
+// Bits of a row shifted so that bit x holds tile x - 1 and tile x + 1
+std::uint64_t from_left(const std::uint64_t* r, int w)
+{
+  return r[w] << 1 | (w > 0 ? r[w - 1] >> 63 : 0);
+}
+
+std::uint64_t from_right(const std::uint64_t* r, int w, int wordsPerRow)
+{
+  return r[w] >> 1 | (w + 1 < wordsPerRow ? r[w + 1] << 63 : 0);
+}
+
+// 4-5 rule, 64 tiles at a time: a tile stays floor when at least 5 tiles
+// of its 3x3 neighborhood are floor. Every row of three tiles is summed
+// into 2 bits, then the rows are added up with bitwise adders.
+void smooth_rows(const Bitboard& from, Bitboard& to, const std::vector<std::uint64_t>& inner, int begin, int end)
+{
+  const int wpr = from.wordsPerRow;
+  for (int y = begin; y < end; ++y)
+  {
+    auto* out = to.row(y);
+    if (y == 0 || y == from.height - 1)
+    {
+      std::fill_n(out, wpr, 0);
+      continue;
+    }
+
+    const auto* above = from.row(y - 1);
+    const auto* mid = from.row(y);
+    const auto* below = from.row(y + 1);
+    for (int w = 0; w < wpr; ++w)
+    {
+      auto rowSum = [&](const std::uint64_t* r, std::uint64_t& s0, std::uint64_t& s1)
+        {
+          const auto l = from_left(r, w);
+          const auto c = r[w];
+          const auto rr = from_right(r, w, wpr);
+          s0 = l ^ c ^ rr;
+          s1 = (l & c) | (rr & (l ^ c));
+        };
+
+      std::uint64_t a0, a1, b0, b1, c0, c1;
+      rowSum(above, a0, a1);
+      rowSum(mid, b0, b1);
+      rowSum(below, c0, c1);
+
+      // a + b, 3 bits
+      const auto t0 = a0 ^ b0;
+      const auto k0 = a0 & b0;
+      const auto t1 = a1 ^ b1 ^ k0;
+      const auto t2 = (a1 & b1) | (k0 & (a1 ^ b1));
+      // + c, 4 bits
+      const auto u0 = t0 ^ c0;
+      const auto m0 = t0 & c0;
+      const auto u1 = t1 ^ c1 ^ m0;
+      const auto m1 = (t1 & c1) | (m0 & (t1 ^ c1));
+      const auto u2 = t2 ^ m1;
+      const auto u3 = t2 & m1;
+
+      out[w] = (u3 | (u2 & (u1 | u0))) & inner[w];
+    }
+  }
+}
+
+// Bits set with probability q / 256, one random word per bit of q
+std::uint64_t noise_word(std::uint64_t& state, unsigned q)
+{
+  std::uint64_t result = 0;
+  for (int i = 0; i < 8; ++i)
+  {
+    const auto r = splitmix(state);
+    result = (q >> i) & 1 ? result | r : result & r;
+  }
+  return result;
+}
+
+// Horizontal leg first, same as the other generators
+void dig_corridor(Bitboard& board, glm::ivec2 from, glm::ivec2 to)
+{
+  for (int x = from.x; x != to.x; x += to.x > from.x ? 1 : -1)
+    board.dig(x, from.y);
+  for (int y = from.y; y != to.y; y += to.y > from.y ? 1 : -1)
+    board.dig(to.x, y);
+  board.dig(to.x, to.y);
+}
+
+// Position along a Z-order curve, nearby tiles get nearby keys
+std::uint64_t z_order(glm::ivec2 pos)
+{
+  auto spread = [](std::uint64_t v)
+    {
+      v = (v | v << 16) & 0x0000FFFF0000FFFF;
+      v = (v | v << 8) & 0x00FF00FF00FF00FF;
+      v = (v | v << 4) & 0x0F0F0F0F0F0F0F0F;
+      v = (v | v << 2) & 0x3333333333333333;
+      v = (v | v << 1) & 0x5555555555555555;
+      return v;
+    };
+  return spread(std::uint32_t(pos.x)) | spread(std::uint32_t(pos.y)) << 1;
+}
+
+struct Run
+{
+  int y;
+  int begin;
+  int end;
+};
+
+// Roots always have the smaller index
+int find_root(std::vector<int>& parent, int i)
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+  return i;
+}
+
+void join(std::vector<int>& parent, int a, int b)
+{
+  a = find_root(parent, a);
+  b = find_root(parent, b);
+  if (a != b)
+    parent[std::max(a, b)] = std::min(a, b);
+}
+
+// Runs of both rows are sorted, so overlaps are found in one sweep
+template<typename Fn>
+void for_overlaps(std::span<const Run> above, std::span<const Run> below, Fn&& fn)
+{
+  for (std::size_t a = 0, b = 0; a < above.size() && b < below.size();)
+  {
+    if (above[a].begin < below[b].end && below[b].begin < above[a].end)
+      fn(a, b);
+    if (above[a].end < below[b].end)
+      ++a;
+    else
+      ++b;
+  }
+}
+
+// Labels horizontal runs of floor instead of tiles, runs touching across
+// rows are joined. Pockets too small to matter get filled, the rest are
+// chained with corridors in Z-order so that the corridors stay short.
+// Every band of rows labels its own runs, only the regions that meet at
+// band borders get joined here. Regions are numbered in run order no
+// matter how many bands there are, so threads don't change the result.
+void connect_regions(Bitboard& board, WorkerPool* workers)
+{
+  constexpr int minRegionSize = 8;
+
+  struct Band
+  {
+    std::vector<Run> runs;
+    // Union-find over the band's runs at first, then the band's region of every run
+    std::vector<int> region;
+    std::vector<int> regionSizes;
+    // Runs of the band's first row are [0, firstRowEnd), the last row starts at lastRowBegin
+    std::size_t firstRowEnd = 0;
+    std::size_t lastRowBegin = 0;
+    int firstRegion = 0;
+    std::vector<std::pair<std::uint64_t, glm::ivec2>> kept;
+  };
+  std::vector<Band> bands(band_count(board, workers));
+
+  for_bands(board, workers, [&](std::size_t b, int begin, int end)
+    {
+      auto& band = bands[b];
+      auto& runs = band.runs;
+      auto& parent = band.region;
+      // Caves average a few runs per 64 tiles
+      runs.reserve(std::size_t(end - begin) * board.wordsPerRow * 4);
+      parent.reserve(runs.capacity());
+
+      std::size_t previousRow = 0;
+      for (int y = begin; y < end; ++y)
+      {
+        const std::size_t rowBegin = runs.size();
+        const auto* r = board.row(y);
+        for (int w = 0; w < board.wordsPerRow; ++w)
+        {
+          // Only looks at run starts, the end of a run is found by skipping ones
+          for (auto starts = r[w] & ~from_left(r, w); starts != 0; starts &= starts - 1)
+          {
+            int x = w * 64 + std::countr_zero(starts);
+            const int runBegin = x;
+            while (x < board.width && board.floor(x, y))
+              x += std::countr_one(r[x / 64] >> (x % 64));
+            runs.push_back({y, runBegin, x});
+            parent.push_back(int(parent.size()));
+          }
+        }
+
+        const std::span<const Run> all(runs);
+        for_overlaps(all.subspan(previousRow, rowBegin - previousRow), all.subspan(rowBegin),
+          [&](std::size_t a, std::size_t b) { join(parent, int(previousRow + a), int(rowBegin + b)); });
+        if (y == begin)
+          band.firstRowEnd = runs.size();
+        previousRow = rowBegin;
+      }
+      band.lastRowBegin = previousRow;
+
+      // A single pass points everything at its root, the second one numbers the roots
+      std::vector<int> size(runs.size(), 0);
+      for (std::size_t i = 0; i < runs.size(); ++i)
+      {
+        parent[i] = parent[parent[i]];
+        size[parent[i]] += runs[i].end - runs[i].begin;
+      }
+      for (std::size_t i = 0; i < runs.size(); ++i)
+      {
+        // Roots keep their number in place of the size
+        if (parent[i] == int(i))
+        {
+          band.regionSizes.push_back(size[i]);
+          size[i] = int(band.regionSizes.size()) - 1;
+        }
+        parent[i] = size[parent[i]];
+      }
+    });
+
+  std::vector<int> size;
+  for (auto& band : bands)
+  {
+    band.firstRegion = int(size.size());
+    size.insert(size.end(), band.regionSizes.begin(), band.regionSizes.end());
+  }
+
+  std::vector<int> parent(size.size());
+  std::iota(parent.begin(), parent.end(), 0);
+  for (std::size_t b = 1; b < bands.size(); ++b)
+  {
+    const auto& above = bands[b - 1];
+    const auto& below = bands[b];
+    for_overlaps(std::span<const Run>(above.runs).subspan(above.lastRowBegin),
+      std::span<const Run>(below.runs).first(below.firstRowEnd),
+      [&](std::size_t a, std::size_t c)
+      {
+        join(parent, above.firstRegion + above.region[above.lastRowBegin + a], below.firstRegion + below.region[c]);
+      });
+  }
+
+  // Regions only ever point at smaller ones, so going through them in order settles them
+  int largest = -1;
+  for (int r = 0; r < int(parent.size()); ++r)
+  {
+    parent[r] = parent[parent[r]];
+    if (parent[r] != r)
+      size[parent[r]] += size[r];
+  }
+  // Tiny maps might have nothing but pockets, the largest one always stays
+  for (int r = 0; r < int(parent.size()); ++r)
+    if (parent[r] == r && (largest < 0 || size[r] > size[largest]))
+      largest = r;
+
+  for_bands(board, workers, [&](std::size_t b, int, int)
+    {
+      auto& band = bands[b];
+      int nextRegion = 0;
+      for (std::size_t i = 0; i < band.runs.size(); ++i)
+      {
+        const auto& run = band.runs[i];
+        // The first run of a region is its root
+        const bool first = band.region[i] == nextRegion;
+        nextRegion += first;
+        const int region = band.firstRegion + band.region[i];
+        const int root = parent[region];
+        if (size[root] < minRegionSize && root != largest)
+        {
+          for (int x = run.begin; x < run.end; ++x)
+            board.fill(x, run.y);
+        }
+        else if (first && root == region)
+          band.kept.push_back({z_order({run.begin, run.y}), {run.begin, run.y}});
+      }
+    });
+
+  std::vector<std::pair<std::uint64_t, glm::ivec2>> regions;
+  for (const auto& band : bands)
+    regions.insert(regions.end(), band.kept.begin(), band.kept.end());
+  std::sort(regions.begin(), regions.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (std::size_t i = 1; i < regions.size(); ++i)
+    dig_corridor(board, regions[i].second, regions[i - 1].second);
+}
+
+} // namespace
+
+void gen_cave_dungeon(DungeonView view, std::uint64_t seed, float density, WorkerPool* workers)
+{
+  constexpr int smoothingSteps = 4;
+
+  const int width = view.extent(1);
+  const int height = view.extent(0);
+  if (width < 3 || height < 3)
+  {
+    std::fill_n(view.data_handle(), view.size(), Tile::Wall);
+    return;
+  }
+
+  const int wordsPerRow = (width + 63) / 64;
+  Bitboard board{width, height, wordsPerRow, std::vector<std::uint64_t>(std::size_t(height) * wordsPerRow, 0)};
+  Bitboard next = board;
+  const auto inner = inner_mask(width, wordsPerRow);
+
+  // Smoothing pushes the floor share away from a half, so the noise starts closer to it.
+  // Every row has its own random stream, so threads don't change the result.
+  const float noise = 0.5f + (density - 0.5f) * 0.4f;
+  const unsigned q = unsigned(std::clamp(noise * 256.f + 0.5f, 0.f, 255.f));
+  for_bands(board, workers, [&](std::size_t, int begin, int end)
+    {
+      for (int y = std::max(begin, 1); y < std::min(end, height - 1); ++y)
+      {
+        std::uint64_t state = seed ^ (std::uint64_t(y) * 0xD1B54A32D192ED03);
+        for (int w = 0; w < wordsPerRow; ++w)
+          board.row(y)[w] = noise_word(state, q) & inner[w];
+      }
+    });
+
+  for (int step = 0; step < smoothingSteps; ++step)
+  {
+    for_bands(board, workers, [&](std::size_t, int begin, int end) { smooth_rows(board, next, inner, begin, end); });
+    std::swap(board, next);
+  }
+
+  connect_regions(board, workers);
+
+  // Eight tiles per byte of the board
+  static const auto spread = []
+    {
+      std::array<std::array<Tile, 8>, 256> result;
+      for (int bits = 0; bits < 256; ++bits)
+        for (int i = 0; i < 8; ++i)
+          result[bits][i] = (bits >> i) & 1 ? Tile::Floor : Tile::Wall;
+      return result;
+    }();
+
+  for_bands(board, workers, [&](std::size_t, int begin, int end)
+    {
+      for (int y = begin; y < end; ++y)
+      {
+        Tile* out = &view(y, 0);
+        const auto* r = board.row(y);
+        for (int x = 0; x < width; x += 8)
+        {
+          const auto bits = (r[x / 64] >> (x % 64)) & 0xFF;
+          std::memcpy(out + x, spread[bits].data(), std::min(8, width - x));
+        }
+      }
+    });
+}
+
+}
@@ -0,0 +1,330 @@
+#include "clusterGraph.hpp"
+
+#include <algorithm>
+#include "dungeonUtils.hpp"
+#include "workerPool.hpp"
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+constexpr int S = ClusterGraph::CLUSTER_SIZE;
+
+int manhattan(glm::ivec2 a, glm::ivec2 b)
+{
+  return glm::abs(a.x - b.x) + glm::abs(a.y - b.y);
+}
+
+} // namespace
+
+ClusterGraph::ClusterGraph(const Dungeon& dd, WorkerPool* workers)
+  : width_{dd.view.extent(1)}
+  , height_{dd.view.extent(0)}
+  , clustersX_{(width_ + S - 1) / S}
+  , clustersY_{(height_ + S - 1) / S}
+{
+  const int clusterCount = clustersX_ * clustersY_;
+  nodes_.assign(std::size_t(clusterCount) * SLOTS, Node{{0, 0}, NONE});
+  clusters_.resize(clusterCount);
+
+  for (int c = 0; c < clusterCount; ++c)
+  {
+    scanBorder(dd, c, Right);
+    scanBorder(dd, c, Bottom);
+  }
+
+  // Every worker only touches the edges of its own clusters
+  auto connectEvery = [&](int first, int step)
+    {
+      std::vector<int> dist;
+      std::vector<int> scratch;
+      for (int c = first; c < clusterCount; c += step)
+        connect(dd, c, dist, scratch);
+    };
+  if (workers)
+    workers->run([&](std::size_t worker) { connectEvery(int(worker), int(workers->size())); });
+  else
+    connectEvery(0, 1);
+
+  seen_.resize(nodes_.size() + 1, 0);
+  closed_.resize(nodes_.size() + 1, 0);
+  cost_.resize(nodes_.size() + 1, 0);
+  parent_.resize(nodes_.size() + 1, 0);
+}
+
+void ClusterGraph::update(const Dungeon& dd, glm::ivec2 pos)
+{
+  if (nodes_.empty() || pos.x < 0 || pos.y < 0 || pos.x >= width_ || pos.y >= height_)
+    return;
+
+  const int cluster = clusterOf(pos);
+  const auto rel = pos - cornerOf(cluster);
+  const int cx = cluster % clustersX_;
+  const int cy = cluster / clustersX_;
+
+  // A tile is only part of a border when it is right next to it,
+  // the border's entrances then change on both sides
+  int dirty[5] {cluster};
+  int dirtyCount = 1;
+  auto rescan = [&](int first, Side side, int other)
+    {
+      scanBorder(dd, first, side);
+      dirty[dirtyCount++] = other;
+    };
+  if (rel.x == 0 && cx > 0)
+    rescan(cluster - 1, Right, cluster - 1);
+  if (rel.x == S - 1 && cx + 1 < clustersX_)
+    rescan(cluster, Right, cluster + 1);
+  if (rel.y == 0 && cy > 0)
+    rescan(cluster - clustersX_, Bottom, cluster - clustersX_);
+  if (rel.y == S - 1 && cy + 1 < clustersY_)
+    rescan(cluster, Bottom, cluster + clustersX_);
+
+  // The query scratch is free in between queries
+  for (int i = 0; i < dirtyCount; ++i)
+    connect(dd, dirty[i], startDist_, bfs_);
+}
+
+std::size_t ClusterGraph::node_count() const
+{
+  std::size_t count = 0;
+  for (auto& cluster : clusters_)
+    count += cluster.entrances.size();
+  return count;
+}
+
+int ClusterGraph::clusterOf(glm::ivec2 pos) const
+{
+  return pos.y / S * clustersX_ + pos.x / S;
+}
+
+glm::ivec2 ClusterGraph::cornerOf(int cluster) const
+{
+  return {cluster % clustersX_ * S, cluster / clustersX_ * S};
+}
+
+std::span<const ClusterGraph::Edge> ClusterGraph::edgesOf(int node) const
+{
+  const auto& cluster = clusters_[node / SLOTS];
+  const int slot = node % SLOTS;
+  return std::span{cluster.edges}.subspan(cluster.edgeBegin[slot], cluster.edgeBegin[slot + 1] - cluster.edgeBegin[slot]);
+}
+
+void ClusterGraph::scanBorder(const Dungeon& dd, int cluster, Side side)
+{
+  const auto corner = cornerOf(cluster);
+  const bool right = side == Right;
+  if (right ? cluster % clustersX_ + 1 >= clustersX_ : cluster / clustersX_ + 1 >= clustersY_)
+    return;
+
+  // `along` walks the border, `across` steps into the other cluster
+  const glm::ivec2 first = corner + (right ? glm::ivec2{S - 1, 0} : glm::ivec2{0, S - 1});
+  const glm::ivec2 along = right ? glm::ivec2{0, 1} : glm::ivec2{1, 0};
+  const glm::ivec2 across = right ? glm::ivec2{1, 0} : glm::ivec2{0, 1};
+  const int length = right ? std::min(S, height_ - corner.y) : std::min(S, width_ - corner.x);
+  const int other = right ? cluster + 1 : cluster + clustersX_;
+  const Side otherSide = right ? Left : Top;
+
+  for (int i = 0; i < S; ++i)
+  {
+    nodes_[slotOf(cluster, side, i)].cluster = NONE;
+    nodes_[slotOf(other, otherSide, i)].cluster = NONE;
+  }
+
+  // One node on each side of a gap
+  auto addEntrance = [&](int i)
+    {
+      const auto pos = first + along * i;
+      nodes_[slotOf(cluster, side, i)] = {pos, cluster};
+      nodes_[slotOf(other, otherSide, i)] = {pos + across, other};
+    };
+
+  int runStart = -1;
+  for (int i = 0; i <= length; ++i)
+  {
+    const auto pos = first + along * i;
+    const bool open = i < length && is_tile_walkable(dd, pos) && is_tile_walkable(dd, pos + across);
+    if (open && runStart < 0)
+      runStart = i;
+    if (open || runStart < 0)
+      continue;
+
+    if (i - runStart >= WIDE_ENTRANCE)
+    {
+      addEntrance(runStart);
+      addEntrance(i - 1);
+    }
+    else
+    {
+      addEntrance((runStart + i - 1) / 2);
+    }
+    runStart = -1;
+  }
+}
+
+void ClusterGraph::connect(const Dungeon& dd, int cluster, std::vector<int>& dist, std::vector<int>& scratch)
+{
+  auto& data = clusters_[cluster];
+  const int firstSlot = cluster * SLOTS;
+  data.entrances.clear();
+  for (int slot = firstSlot; slot < firstSlot + SLOTS; ++slot)
+    if (nodes_[slot].cluster != NONE)
+      data.entrances.push_back(slot);
+
+  // The other side of a gap always has a node too, borders get scanned on both sides at once
+  auto across = [&](int slot)
+    {
+      const int i = slot % S;
+      switch (Side((slot - firstSlot) / S))
+      {
+      case Right: return slotOf(cluster + 1, Left, i);
+      case Bottom: return slotOf(cluster + clustersX_, Top, i);
+      case Left: return slotOf(cluster - 1, Right, i);
+      default: return slotOf(cluster - clustersX_, Bottom, i);
+      }
+    };
+
+  data.edgeBegin.assign(SLOTS + 1, 0);
+  data.edges.clear();
+  for (int k = 0; k < SLOTS; ++k)
+  {
+    if (const int slot = firstSlot + k; nodes_[slot].cluster != NONE)
+    {
+      data.edges.push_back({across(slot), 1});
+      clusterDistances(dd, nodes_[slot].pos, dist, scratch);
+      // Corner tiles can be on two borders, those nodes are 0 apart
+      for (int other : data.entrances)
+        if (other != slot && dist[other - firstSlot] >= 0)
+          data.edges.push_back({other, dist[other - firstSlot]});
+    }
+    data.edgeBegin[k + 1] = int(data.edges.size());
+  }
+}
+
+bool ClusterGraph::is_long_range(glm::ivec2 from, glm::ivec2 to) const
+{
+  return !nodes_.empty() && manhattan(from, to) > 2 * S && clusterOf(from) != clusterOf(to);
+}
+
+void ClusterGraph::clusterDistances(const Dungeon& dd, glm::ivec2 pos, std::vector<int>& out,
+  std::vector<int>& scratch) const
+{
+  const int cluster = clusterOf(pos);
+  const glm::ivec2 corner = cornerOf(cluster);
+  const glm::ivec2 size{std::min(S, width_ - corner.x), std::min(S, height_ - corner.y)};
+
+  // Local distances followed by the BFS queue
+  scratch.assign(2 * S * S, -1);
+  int* dist = scratch.data();
+  int* queue = scratch.data() + S * S;
+  int head = 0;
+  int tail = 0;
+
+  auto local = [&](glm::ivec2 p) { return (p.y - corner.y) * S + (p.x - corner.x); };
+  dist[local(pos)] = 0;
+  queue[tail++] = local(pos);
+
+  static const glm::ivec2 neighbors[] {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  while (head < tail)
+  {
+    const int cur = queue[head++];
+    const glm::ivec2 p = corner + glm::ivec2{cur % S, cur / S};
+    for (auto delta : neighbors)
+    {
+      const auto next = p + delta;
+      const auto rel = next - corner;
+      if (rel.x < 0 || rel.y < 0 || rel.x >= size.x || rel.y >= size.y
+        || dist[local(next)] >= 0 || !is_tile_walkable(dd, next))
+        continue;
+      dist[local(next)] = dist[cur] + 1;
+      queue[tail++] = local(next);
+    }
+  }
+
+  out.assign(SLOTS, -1);
+  for (int slot : clusters_[cluster].entrances)
+    out[slot - cluster * SLOTS] = dist[local(nodes_[slot].pos)];
+}
+
+void ClusterGraph::nextGeneration()
+{
+  if (++generation_ != 0)
+    return;
+
+  std::fill(seen_.begin(), seen_.end(), 0);
+  std::fill(closed_.begin(), closed_.end(), 0);
+  generation_ = 1;
+}
+
+std::optional<glm::ivec2> ClusterGraph::next_waypoint(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to)
+{
+  if (!is_tile_walkable(dd, from) || !is_tile_walkable(dd, to))
+    return std::nullopt;
+
+  const int startCluster = clusterOf(from);
+  const int goalCluster = clusterOf(to);
+  if (startCluster == goalCluster)
+    return to;
+
+  clusterDistances(dd, from, startDist_, bfs_);
+  clusterDistances(dd, to, goalDist_, bfs_);
+
+  const int goal = int(nodes_.size());
+  auto heuristic = [&](int node) { return node == goal ? 0 : manhattan(nodes_[node].pos, to); };
+  auto worse = [](const OpenNode& a, const OpenNode& b) { return a.f > b.f || (a.f == b.f && a.g < b.g); };
+
+  nextGeneration();
+  open_.clear();
+
+  auto relax = [&](int node, int cost, int parent)
+    {
+      if (closed_[node] == generation_ || (seen_[node] == generation_ && cost_[node] <= cost))
+        return;
+      seen_[node] = generation_;
+      cost_[node] = cost;
+      parent_[node] = parent;
+      open_.push_back({cost + heuristic(node), cost, node});
+      std::push_heap(open_.begin(), open_.end(), worse);
+    };
+
+  // The start and the goal are not part of the graph, they get connected
+  // to the entrances of their clusters just for this query
+  for (int slot : clusters_[startCluster].entrances)
+    if (const int d = startDist_[slot - startCluster * SLOTS]; d >= 0)
+      relax(slot, d, -1);
+
+  while (!open_.empty())
+  {
+    std::pop_heap(open_.begin(), open_.end(), worse);
+    const auto cur = open_.back();
+    open_.pop_back();
+
+    if (closed_[cur.node] == generation_)
+      continue;
+    closed_[cur.node] = generation_;
+
+    if (cur.node == goal)
+    {
+      // The earliest node outside of the start cluster
+      std::optional<glm::ivec2> waypoint;
+      for (int node = parent_[goal]; node >= 0; node = parent_[node])
+        if (nodes_[node].cluster != startCluster)
+          waypoint = nodes_[node].pos;
+      return waypoint ? waypoint : to;
+    }
+
+    if (nodes_[cur.node].cluster == goalCluster)
+      if (const int d = goalDist_[cur.node - goalCluster * SLOTS]; d >= 0)
+        relax(goal, cur.g + d, cur.node);
+
+    for (auto edge : edgesOf(cur.node))
+      relax(edge.to, cur.g + edge.cost, cur.node);
+  }
+
+  return std::nullopt;
+}
+
+}
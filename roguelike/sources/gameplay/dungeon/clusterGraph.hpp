@@ -0,0 +1,129 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+
+
+namespace dungeon
+{
+
+class WorkerPool;
+
+// Lives on the dungeon entity. Abstract graph for hierarchical pathfinding
+// (HPA*): the dungeon is split into square clusters, walkable gaps in the
+// borders between neighboring clusters become entrances, and every
+// cluster stores the walking distances between its own entrances.
+// Long queries search this graph and only refine the way to the next
+// cluster on the actual tiles.
+class ClusterGraph
+{
+public:
+  static constexpr int CLUSTER_SIZE = 16;
+  // Gaps at least this wide get an entrance at both ends instead of the middle
+  static constexpr int WIDE_ENTRANCE = 6;
+
+  ClusterGraph() = default;
+  // Clusters are independent, so they get split between the workers when given some
+  explicit ClusterGraph(const Dungeon& dd, WorkerPool* workers = nullptr);
+
+  // Has to be called after the tile at pos changed. Only the cluster of pos
+  // gets reconnected, plus its neighbors when pos is on a border they share.
+  void update(const Dungeon& dd, glm::ivec2 pos);
+
+  // Whether a query is worth going through the abstract graph
+  bool is_long_range(glm::ivec2 from, glm::ivec2 to) const;
+
+  // Entrance to step on to leave the cluster of `from` on the way to `to`,
+  // `to` itself if the way never leaves the cluster, nullopt if unreachable.
+  // Does not allocate once the scratch buffers have grown.
+  std::optional<glm::ivec2> next_waypoint(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to);
+
+  std::size_t node_count() const;
+
+private:
+  // Every cluster has a slot for each tile along each of its borders, so the
+  // id of an entrance only depends on where it is and an edit never
+  // renumbers the entrances of the clusters it doesn't touch
+  static constexpr int SLOTS = 4 * CLUSTER_SIZE;
+
+  enum Side
+  {
+    Right,
+    Bottom,
+    Left,
+    Top,
+  };
+
+  struct Node
+  {
+    glm::ivec2 pos;
+    // NONE for slots without an entrance
+    int cluster;
+  };
+
+  struct Edge
+  {
+    int to;
+    int cost;
+  };
+
+  // Edges are stored in CSR form by slot
+  struct Cluster
+  {
+    // Slots that hold an entrance
+    std::vector<int> entrances;
+    std::vector<int> edgeBegin;
+    std::vector<Edge> edges;
+  };
+
+  struct OpenNode
+  {
+    int f;
+    int g;
+    int node;
+  };
+
+  static constexpr int NONE = -1;
+
+  int clusterOf(glm::ivec2 pos) const;
+  glm::ivec2 cornerOf(int cluster) const;
+  int slotOf(int cluster, Side side, int i) const { return cluster * SLOTS + side * CLUSTER_SIZE + i; }
+  std::span<const Edge> edgesOf(int node) const;
+  // Puts entrances into the gaps of the border to the right of or below
+  // the cluster, on both sides of it
+  void scanBorder(const Dungeon& dd, int cluster, Side side);
+  // Edges of the cluster's entrances, to each other and across the borders
+  void connect(const Dungeon& dd, int cluster, std::vector<int>& dist, std::vector<int>& scratch);
+  // Walking distances inside of the cluster from pos to all of the
+  // cluster's slots, -1 for unreachable ones and empty slots
+  void clusterDistances(const Dungeon& dd, glm::ivec2 pos, std::vector<int>& out, std::vector<int>& scratch) const;
+  void nextGeneration();
+
+private:
+  int width_{0};
+  int height_{0};
+  int clustersX_{0};
+  int clustersY_{0};
+
+  // One per slot
+  std::vector<Node> nodes_;
+  std::vector<Cluster> clusters_;
+
+  // Query scratch, the extra slot past the last node is the goal
+  std::uint32_t generation_{0};
+  std::vector<std::uint32_t> seen_;
+  std::vector<std::uint32_t> closed_;
+  std::vector<int> cost_;
+  std::vector<int> parent_;
+  std::vector<OpenNode> open_;
+  std::vector<int> startDist_;
+  std::vector<int> goalDist_;
+  std::vector<int> bfs_;
+};
+
+}
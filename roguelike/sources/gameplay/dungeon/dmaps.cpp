@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <queue>
 #include <glm/glm.hpp>
+#include <assert.hpp>
 
 
 namespace dungeon::dmaps
@@ -21,6 +22,28 @@ void clear(DmapView dmap)
   std::fill_n(dmap.data_handle(), dmap.size(), INF);
 }
 
+void acquire(flecs::entity dmap)
+{
+  auto users = dmap.get_mut<DmapUsers>();
+  NG_ASSERT(users);
+  users->count++;
+}
+
+void release(flecs::entity dmap)
+{
+  // Dmaps might die before their readers when a level is torn down
+  if (!dmap.is_alive())
+    return;
+  auto users = dmap.get_mut<DmapUsers>();
+  NG_ASSERT(users && users->count > 0);
+  users->count--;
+}
+
+bool is_active(const Dmap& dmap, const DmapUsers& users)
+{
+  return users.count > 0 || dmap.debugDraw;
+}
+
 void generate(DmapView map, DungeonView dungeon, fu2::function_view<PotentialFuncSig> potential)
 {
   auto safeValueAt = [&map](glm::ivec2 v)
@@ -4,6 +4,7 @@
 #include <experimental/mdspan>
 #include <vector>
 #include <function2/function2.hpp>
+#include <flecs.h>
 
 
 namespace dungeon::dmaps
@@ -19,6 +20,18 @@ struct Dmap
   bool debugDraw{false};
 };
 
+// Number of live readers (smart movements, BT nodes) of a dmap.
+// A dmap nobody reads and nobody debug-draws is dormant and
+// does not get regenerated.
+struct DmapUsers
+{
+  int count{0};
+};
+
+void acquire(flecs::entity dmap);
+void release(flecs::entity dmap);
+bool is_active(const Dmap& dmap, const DmapUsers& users);
+
 Dmap make(DungeonView dungeon);
 void clear(DmapView dmap);
 using PotentialFuncSig = float(float) const;
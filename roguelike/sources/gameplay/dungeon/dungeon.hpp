@@ -1,8 +1,15 @@
 #pragma once
 
 #include <span>
+#include <memory>
+#include <cstdint>
 #include <vector>
+#include <unordered_map>
 #include <experimental/mdspan>
+#include <flecs.h>
+#include <glm/glm.hpp>
+
+#include "walkability.hpp"
 
 
 namespace dungeon
@@ -16,10 +23,70 @@ enum Tile : char
 
 using DungeonView = std::experimental::mdspan<Tile, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
 
+class MappedFile;
+
 struct Dungeon
 {
   std::vector<Tile> data;
   DungeonView view;
+  // Set when the tiles live in a mapped dungeon file instead of data
+  std::shared_ptr<MappedFile> file;
+  // Bumped whenever tiles change, lets caches know they are stale
+  std::uint32_t revision{0};
+  // Floor tiles as bits, for everything that only cares about walls.
+  // Built by make_dungeon, generate_dungeon and create_dungeon,
+  // kept up to date by set_tile.
+  WalkabilityBits walkable;
+};
+
+// Tile indices (y * width + x) that can be added, removed
+// and picked at random in constant time
+struct TileSet
+{
+  static constexpr int NONE = -1;
+
+  std::vector<int> tiles;
+  // Where each tile sits in `tiles`, NONE if it is not in the set
+  std::vector<int> slots;
 };
 
+// Lives on the dungeon entity, every floor tile. Kept up to date by set_tile.
+struct WalkableTiles
+{
+  TileSet floor;
+};
+
+using OccupancyView = std::experimental::mdspan<flecs::entity_t, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
+
+// Lives on the dungeon entity, tracks who stands (or is about to stand)
+// on each tile. Follows MovePos, 0 means the tile is free.
+struct Occupancy
+{
+  std::vector<flecs::entity_t> data;
+  OccupancyView view;
+  // Floor tiles nobody stands on
+  TileSet free;
+};
+
+// Lives on the dungeon entity, items lying on each tile
+struct Pickups
+{
+  static std::uint64_t tileKey(glm::ivec2 pos)
+  {
+    return std::uint64_t(std::uint32_t(pos.y)) << 32 | std::uint32_t(pos.x);
+  }
+
+  std::unordered_multimap<std::uint64_t, flecs::entity> items;
+};
+
+// World singleton pointing to the dungeon the player is on,
+// the one that gets simulated and drawn
+struct CurrentDungeon
+{
+  flecs::entity entity;
+};
+
+// Exclusive relationship, (OnLevel, dungeon entity) on everything that lives on a level
+struct OnLevel {};
+
 }
@@ -0,0 +1,181 @@
+#include "dungeonFile.hpp"
+
+#include <limits>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include "walkability.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace dungeon
+{
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path)
+{
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return nullptr;
+
+  LARGE_INTEGER size;
+  HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0
+    ? CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr)
+    : nullptr;
+  // The view keeps the mapping alive
+  void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+  if (mapping)
+    CloseHandle(mapping);
+  CloseHandle(file);
+  if (!data)
+    return nullptr;
+
+  return std::shared_ptr<MappedFile>(new MappedFile(static_cast<std::byte*>(data), std::size_t(size.QuadPart)));
+}
+
+MappedFile::~MappedFile()
+{
+  UnmapViewOfFile(data_);
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  void* data = fstat(fd, &info) == 0 && info.st_size > 0
+    ? mmap(nullptr, std::size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+    : MAP_FAILED;
+  // The mapping keeps the file alive
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return nullptr;
+
+  return std::shared_ptr<MappedFile>(new MappedFile(static_cast<std::byte*>(data), std::size_t(info.st_size)));
+}
+
+MappedFile::~MappedFile()
+{
+  munmap(data_, size_);
+}
+
+#endif
+
+static std::uint64_t align_section(std::uint64_t offset)
+{
+  return (offset + 63) & ~std::uint64_t{63};
+}
+
+bool save_dungeon(const std::filesystem::path& path, const Dungeon& dd, const Regions* regions)
+{
+  const std::size_t tileCount = dd.view.size();
+
+  DungeonFileHeader header
+    {
+      .magic = DungeonFileHeader::MAGIC,
+      .version = DungeonFileHeader::VERSION,
+      .width = dd.view.extent(1),
+      .height = dd.view.extent(0),
+      .tiles = align_section(sizeof(DungeonFileHeader)),
+    };
+  std::uint64_t end = header.tiles + tileCount;
+  if (regions)
+  {
+    header.regions = align_section(end);
+    header.regionSizes = align_section(header.regions + tileCount * sizeof(std::uint32_t));
+    header.regionCount = regions->sizes.size();
+    end = header.regionSizes + header.regionCount * sizeof(std::int32_t);
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  auto write = [&](std::uint64_t offset, const void* data, std::size_t bytes)
+    {
+      // Zeroes up to the section start
+      static const char zeroes[64] = {};
+      out.write(zeroes, std::streamsize(offset - std::uint64_t(out.tellp())));
+      out.write(static_cast<const char*>(data), std::streamsize(bytes));
+    };
+
+  write(0, &header, sizeof(header));
+  write(header.tiles, dd.view.data_handle(), tileCount);
+  if (regions)
+  {
+    write(header.regions, regions->view.data_handle(), tileCount * sizeof(std::uint32_t));
+    static_assert(sizeof(int) == sizeof(std::int32_t));
+    write(header.regionSizes, regions->sizes.data(), regions->sizes.size() * sizeof(int));
+  }
+  return bool(out);
+}
+
+std::optional<LoadedDungeon> load_dungeon(const std::filesystem::path& path)
+{
+  auto file = MappedFile::open(path);
+  if (!file || file->size() < sizeof(DungeonFileHeader))
+    return std::nullopt;
+
+  DungeonFileHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (header.magic != DungeonFileHeader::MAGIC || header.version != DungeonFileHeader::VERSION
+    || header.width <= 0 || header.height <= 0)
+    return std::nullopt;
+
+  // Tiles are indexed with ints, walkability pads the rows on top
+  const std::size_t tileCount = std::size_t(header.width) * header.height;
+  if (tileCount > std::size_t(std::numeric_limits<int>::max() / 2))
+    return std::nullopt;
+
+  // Divides instead of multiplying the count, nothing in the header can overflow it
+  auto fits = [&](std::uint64_t offset, std::uint64_t count, std::size_t elementSize)
+    {
+      return offset != 0 && offset % elementSize == 0 && offset <= file->size()
+        && count <= (file->size() - offset) / elementSize;
+    };
+  if (!fits(header.tiles, tileCount, 1))
+    return std::nullopt;
+
+  LoadedDungeon result;
+  auto& dd = result.dungeon;
+  dd.view = DungeonView(reinterpret_cast<Tile*>(file->data() + header.tiles), header.height, header.width);
+  dd.file = file;
+
+  // Words saved along with the tiles could disagree with them
+  dd.walkable = make_walkability(dd);
+
+  if (!fits(header.regions, tileCount, sizeof(std::uint32_t))
+    || !fits(header.regionSizes, header.regionCount, sizeof(std::int32_t)))
+    return result;
+
+  // Labels index the sizes, a bad one would write out of bounds on the first edit
+  const auto* labels = reinterpret_cast<const std::uint32_t*>(file->data() + header.regions);
+  if (std::all_of(labels, labels + tileCount, [&](std::uint32_t label) { return label < header.regionCount; }))
+  {
+    Regions regions
+      {
+        .file = file,
+        .sizes = std::vector<int>(header.regionCount),
+      };
+    regions.view = RegionView(reinterpret_cast<std::uint32_t*>(file->data() + header.regions), dd.view.extents());
+    std::memcpy(regions.sizes.data(), file->data() + header.regionSizes, header.regionCount * sizeof(std::int32_t));
+    result.regions = std::move(regions);
+  }
+
+  return result;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <filesystem>
+
+#include "dungeon.hpp"
+#include "regions.hpp"
+
+
+namespace dungeon
+{
+
+// A whole file mapped copy-on-write: writes through it stay in
+// memory and never reach the disk
+class MappedFile
+{
+public:
+  static std::shared_ptr<MappedFile> open(const std::filesystem::path& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::byte* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+private:
+  MappedFile(std::byte* data, std::size_t size) : data_{data}, size_{size} {}
+
+private:
+  std::byte* data_;
+  std::size_t size_;
+};
+
+// Binary dungeon file, laid out so that every section can be used right
+// where it is mapped. Native byte order, sections are 64 byte aligned:
+//   header
+//   tiles, one byte each, row major
+//   walkability words, padding included (no longer written, loading builds them from the tiles)
+//   region labels, one uint32 per tile (optional)
+//   region sizes, one int32 per label (with the labels)
+struct DungeonFileHeader
+{
+  static constexpr std::uint32_t MAGIC = 0x474E4444; // "DDNG"
+  static constexpr std::uint32_t VERSION = 1;
+
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::int32_t width;
+  std::int32_t height;
+  // Byte offsets from the start of the file, 0 for missing sections
+  std::uint64_t tiles;
+  std::uint64_t walkable;
+  std::uint64_t regions;
+  std::uint64_t regionSizes;
+  std::uint64_t regionCount;
+};
+
+struct LoadedDungeon
+{
+  Dungeon dungeon;
+  // Only when the file has them, prepare_level can take them as they are
+  std::optional<Regions> regions;
+};
+
+// Regions only go along when given
+bool save_dungeon(const std::filesystem::path& path, const Dungeon& dd, const Regions* regions = nullptr);
+
+// Files are not trusted. Tiles and region labels are used in place, but
+// every label gets checked against the region count and walkability is
+// built from the tiles, so both get read once. Regions that don't check
+// out are left behind, prepare_level builds them from the tiles then.
+std::optional<LoadedDungeon> load_dungeon(const std::filesystem::path& path);
+
+}
@@ -1,75 +1,157 @@
 #include "dungeonGenerator.hpp"
 #include "dungeonUtils.hpp"
-#include <cstring>
+#include <cmath>
 #include <random>
-#include <chrono>
+#include <vector>
+#include <algorithm>
 #include <glm/glm.hpp>
 
 
 namespace dungeon
 {
 
-void gen_drunk_dungeon(DungeonView view)
+namespace
 {
-  std::memset(view.data_handle(), Tile::Wall, view.size());
-
-  // generator
-  unsigned seed = unsigned(std::chrono::system_clock::now().time_since_epoch().count() % INT_MAX);
-  std::default_random_engine generator(seed);
-
-  // distributions
-  std::uniform_int_distribution<int> widthDist(1, view.extent(1) - 2);
-  std::uniform_int_distribution<int> heightDist(1, view.extent(0) - 2);
-  std::uniform_int_distribution<int> dirDist(0, 3);
-  auto rndWd = [&]() { return widthDist(generator); };
-  auto rndHt = [&]() { return heightDist(generator); };
-  auto rndDir = [&]() { return dirDist(generator); };
-
-  const int dirs[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
-
-  constexpr std::size_t numIter = 4;
-  constexpr std::size_t maxExcavations = 200;
-  std::vector<glm::ivec2> startPos;
-  for (std::size_t iter = 0; iter < numIter; ++iter)
+
+// Engines are the same everywhere, standard distributions are not
+using Engine = std::mt19937_64;
+
+int roll(Engine& engine, int lo, int hi)
+{
+  return lo + int(engine() % std::uint64_t(hi - lo + 1));
+}
+
+const glm::ivec2 dirs[4] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+// Horizontal leg first
+void dig_corridor(DungeonView view, glm::ivec2 from, glm::ivec2 to)
+{
+  for (int x = from.x; x != to.x; x += to.x > from.x ? 1 : -1)
+    view(from.y, x) = Tile::Floor;
+  for (int y = from.y; y != to.y; y += to.y > from.y ? 1 : -1)
+    view(y, to.x) = Tile::Floor;
+  view(to.y, to.x) = Tile::Floor;
+}
+
+} // namespace
+
+void gen_drunk_dungeon(DungeonView view, std::uint64_t seed, float density)
+{
+  constexpr int maxExcavations = 200;
+
+  std::fill_n(view.data_handle(), view.size(), Tile::Wall);
+  const int width = view.extent(1);
+  const int height = view.extent(0);
+  if (width < 3 || height < 3)
+    return;
+
+  Engine engine(seed);
+  const std::size_t wanted = std::max(1, int(density * float((width - 2) * (height - 2))));
+
+  // Every walk after the first starts on an already dug tile,
+  // that keeps the level connected without any corridors
+  std::vector<glm::ivec2> dug;
+  dug.reserve(wanted);
+  glm::ivec2 pos{roll(engine, 1, width - 2), roll(engine, 1, height - 2)};
+  while (dug.size() < wanted)
   {
-    // select random point on map
-    int x = rndWd();
-    int y = rndHt();
-    startPos.push_back({int(x), int(y)});
-    std::size_t numExcavations = 0;
-    while (numExcavations < maxExcavations)
+    if (!dug.empty())
+      pos = dug[roll(engine, 0, int(dug.size()) - 1)];
+
+    // Walking over dug out tiles doesn't count, so walks get a step limit too
+    int numExcavations = 0;
+    for (int steps = 0; numExcavations < maxExcavations && steps < 8 * maxExcavations && dug.size() < wanted; ++steps)
     {
-      if (view(y, x) == Tile::Wall)
+      if (view(pos.y, pos.x) == Tile::Wall)
       {
-        numExcavations++;
-        view(y, x) = Tile::Floor;
+        view(pos.y, pos.x) = Tile::Floor;
+        dug.push_back(pos);
+        ++numExcavations;
       }
-      // choose random dir
-      std::size_t dir = rndDir(); // 0 - right, 1 - up, 2 - left, 3 - down
-      int newX = std::min(std::max(x + dirs[dir][0], 1), view.extent(1) - 2);
-      int newY = std::min(std::max(y + dirs[dir][1], 1), view.extent(0) - 2);
-      x = std::size_t(newX);
-      y = std::size_t(newY);
+      const auto dir = dirs[roll(engine, 0, 3)];
+      pos.x = std::clamp(pos.x + dir.x, 1, width - 2);
+      pos.y = std::clamp(pos.y + dir.y, 1, height - 2);
     }
   }
+}
+
+void gen_bsp_dungeon(DungeonView view, std::uint64_t seed, float density)
+{
+  constexpr int minLeaf = 8;
 
-  auto distSq = [](auto& a, auto& b){ return glm::dot(glm::vec2(a - b), glm::vec2(a - b)); };
+  struct Rect
+  {
+    int x, y, w, h;
+  };
+
+  std::fill_n(view.data_handle(), view.size(), Tile::Wall);
+  if (view.extent(1) < 3 || view.extent(0) < 3)
+    return;
+
+  Engine engine(seed);
+  // Rooms take up `density` of their leaf, leaves keep a wall on every side
+  const float side = std::sqrt(density);
 
-  // construct a path from start pos to all other start poses
-  for (const glm::ivec2 &spos : startPos)
-    for (const glm::ivec2 &epos : startPos)
+  // Returns a tile of one of the rooms inside, siblings get joined through those
+  auto split = [&](auto& self, Rect r) -> glm::ivec2
     {
-      glm::ivec2 pos = spos;
-      while (distSq(pos, epos) > 0.f)
+      const bool alongX = r.w >= 2 * minLeaf;
+      const bool alongY = r.h >= 2 * minLeaf;
+      if (!alongX && !alongY)
       {
-        const glm::ivec2 delta = epos - pos;
-        if (abs(delta.x) > abs(delta.y))
-          pos.x += delta.x > 0 ? 1 : -1;
-        else
-          pos.y += delta.y > 0 ? 1 : -1;
-        view(pos.y, pos.x) = Tile::Floor;
+        const int w = std::clamp(int(float(r.w - 2) * side + 0.5f) + roll(engine, -1, 1), 1, r.w - 2);
+        const int h = std::clamp(int(float(r.h - 2) * side + 0.5f) + roll(engine, -1, 1), 1, r.h - 2);
+        const int x = roll(engine, r.x + 1, r.x + r.w - 1 - w);
+        const int y = roll(engine, r.y + 1, r.y + r.h - 1 - h);
+        for (int ry = y; ry < y + h; ++ry)
+          for (int rx = x; rx < x + w; ++rx)
+            view(ry, rx) = Tile::Floor;
+        return {x + w / 2, y + h / 2};
       }
-    }
+
+      glm::ivec2 a, b;
+      if (alongX && (!alongY || r.w > r.h || (r.w == r.h && roll(engine, 0, 1))))
+      {
+        const int cut = roll(engine, r.x + minLeaf, r.x + r.w - minLeaf);
+        a = self(self, Rect{r.x, r.y, cut - r.x, r.h});
+        b = self(self, Rect{cut, r.y, r.x + r.w - cut, r.h});
+      }
+      else
+      {
+        const int cut = roll(engine, r.y + minLeaf, r.y + r.h - minLeaf);
+        a = self(self, Rect{r.x, r.y, r.w, cut - r.y});
+        b = self(self, Rect{r.x, cut, r.w, r.y + r.h - cut});
+      }
+      dig_corridor(view, a, b);
+      return roll(engine, 0, 1) ? a : b;
+    };
+
+  split(split, Rect{0, 0, view.extent(1), view.extent(0)});
+}
+
+void generate_dungeon(DungeonView view, const GeneratorParams& params, WorkerPool* workers)
+{
+  const float density = std::clamp(params.density, 0.f, 1.f);
+  switch (params.kind)
+  {
+  case GeneratorKind::DrunkWalk:
+    gen_drunk_dungeon(view, params.seed, density);
+    break;
+  case GeneratorKind::Bsp:
+    gen_bsp_dungeon(view, params.seed, density);
+    break;
+  case GeneratorKind::Caves:
+    gen_cave_dungeon(view, params.seed, density, workers);
+    break;
+  }
+}
+
+Dungeon generate_dungeon(const GeneratorParams& params, WorkerPool* workers)
+{
+  auto result = make_dungeon(params.width, params.height);
+  generate_dungeon(result.view, params, workers);
+  result.walkable = make_walkability(result);
+  return result;
 }
 
 }
@@ -1,10 +1,40 @@
 #pragma once
 #include "gameplay/dungeon/dungeon.hpp"
 #include <cstddef>
+#include <cstdint>
 
 namespace dungeon
 {
 
-void gen_drunk_dungeon(DungeonView view);
+class WorkerPool;
+
+enum class GeneratorKind
+{
+  DrunkWalk,
+  Bsp,
+  Caves
+};
+
+// Same params (and seed) always give the same level, on every platform
+struct GeneratorParams
+{
+  GeneratorKind kind = GeneratorKind::DrunkWalk;
+  std::uint64_t seed = 0;
+  int width = 50;
+  int height = 50;
+  // Roughly the share of the map that ends up as floor
+  float density = 0.35f;
+
+  bool operator==(const GeneratorParams&) const = default;
+};
+
+// Every generator leaves a wall border and a single connected floor region.
+// Caves get split between the workers when given some, the level comes out the same.
+Dungeon generate_dungeon(const GeneratorParams& params, WorkerPool* workers = nullptr);
+void generate_dungeon(DungeonView view, const GeneratorParams& params, WorkerPool* workers = nullptr);
+
+void gen_drunk_dungeon(DungeonView view, std::uint64_t seed, float density);
+void gen_bsp_dungeon(DungeonView view, std::uint64_t seed, float density);
+void gen_cave_dungeon(DungeonView view, std::uint64_t seed, float density, WorkerPool* workers = nullptr);
 
 }
@@ -1,39 +1,85 @@
 #include "dungeonUtils.hpp"
+#include <bit>
 #include <vector>
 #include <random>
+#include <optional>
+#include <algorithm>
+#include <function2/function2.hpp>
+#include <assert.hpp>
+#include "regions.hpp"
+#include "clusterGraph.hpp"
 
 
 namespace dungeon
 {
 
-glm::ivec2 find_walkable_tile(flecs::world& ecs)
+static glm::ivec2 find_walkable_tile_in(flecs::entity level, fu2::function_view<std::uint32_t(const Regions&)> region)
 {
-  static auto dungeonDataQuery = ecs.query<const Dungeon>();
+  // The wanted region is usually most of the map, so random guesses rarely miss
+  constexpr int MAX_GUESSES = 32;
   static std::default_random_engine engine;
 
-  glm::ivec2 res{0, 0};
-  dungeonDataQuery.each([&](const Dungeon& dd)
-  {
-    // prebuild all walkable and get one of them
-    std::vector<glm::ivec2> posList;
+  auto& dd = *level.get<Dungeon>();
+  auto& regions = *level.get<Regions>();
+  const auto wanted = region(regions);
+  const int width = dd.view.extent(1);
+
+  auto matches = [&](int tile)
+    {
+      return dd.walkable.walkable({tile % width, tile / width}) && regions.view.data_handle()[tile] == wanted;
+    };
+  auto pick = [&](const TileSet& set) -> std::optional<glm::ivec2>
+    {
+      if (set.tiles.empty())
+        return std::nullopt;
+
+      std::uniform_int_distribution<std::size_t> distr(0, set.tiles.size() - 1);
+      for (int i = 0; i < MAX_GUESSES; ++i)
+        if (int tile = set.tiles[distr(engine)]; matches(tile))
+          return glm::ivec2{tile % width, tile / width};
+
+      // Small region, count its tiles and take one of them
+      const auto count = std::count_if(set.tiles.begin(), set.tiles.end(), matches);
+      if (count == 0)
+        return std::nullopt;
+      auto nth = std::uniform_int_distribution<std::ptrdiff_t>(0, count - 1)(engine);
+      for (int tile : set.tiles)
+        if (matches(tile) && nth-- == 0)
+          return glm::ivec2{tile % width, tile / width};
+      return std::nullopt;
+    };
 
-    for (int y = 0; y < dd.view.extent(0); ++y)
-      for (int x = 0; x < dd.view.extent(1); ++x)
-        if (dd.view(y, x) == Tile::Floor)
-          posList.push_back(glm::ivec2{x, y});
+  auto pos = pick(level.get<Occupancy>()->free);
+  if (!pos)
+    pos = pick(level.get<WalkableTiles>()->floor);
+  NG_ASSERT(pos.has_value());
+  return *pos;
+}
 
-    std::uniform_int_distribution<> distr(0, posList.size() - 1);
-    res = posList[distr(engine)];
-  });
-  return res;
+glm::ivec2 find_walkable_tile(flecs::entity level)
+{
+  return find_walkable_tile_in(level, [](const Regions& regions) { return largest_region(regions); });
+}
+
+glm::ivec2 find_walkable_tile(flecs::entity level, glm::ivec2 reachableFrom)
+{
+  return find_walkable_tile_in(level,
+    [reachableFrom](const Regions& regions) { return region_of(regions, reachableFrom); });
+}
+
+glm::ivec2 find_walkable_tile(flecs::world& ecs)
+{
+  return find_walkable_tile(ecs.get<CurrentDungeon>()->entity);
+}
+
+glm::ivec2 find_walkable_tile(flecs::world& ecs, glm::ivec2 reachableFrom)
+{
+  return find_walkable_tile(ecs.get<CurrentDungeon>()->entity, reachableFrom);
 }
 
 bool is_tile_walkable(const Dungeon& dd, glm::ivec2 pos)
 {
-  if (pos.x < 0 || pos.x >= dd.view.extent(1) ||
-      pos.y < 0 || pos.y >= dd.view.extent(0))
-    return false;
-  return dd.view(pos.y, pos.x) == Tile::Floor;
+  return dd.walkable.walkable_anywhere(pos);
 }
 
 Dungeon make_dungeon(int width, int height)
@@ -42,9 +88,140 @@ Dungeon make_dungeon(int width, int height)
     {
       .data = std::vector<Tile>(width * height),
     };
-  result.view = DungeonView(result.data.data(), width, height);
+  result.view = DungeonView(result.data.data(), height, width);
+  result.walkable = make_walkability(result);
+  return result;
+}
+
+void set_tile(flecs::entity level, glm::ivec2 pos, Tile tile)
+{
+  auto& dd = *level.get_mut<Dungeon>();
+  if (pos.x < 0 || pos.x >= dd.view.extent(1) || pos.y < 0 || pos.y >= dd.view.extent(0)
+    || dd.view(pos.y, pos.x) == tile)
+    return;
+
+  dd.view(pos.y, pos.x) = tile;
+  dd.walkable.set(pos, tile == Tile::Floor);
+  // Lets the per-agent and per-query caches know they are stale
+  ++dd.revision;
+
+  const int index = pos.y * dd.view.extent(1) + pos.x;
+  auto& floor = level.get_mut<WalkableTiles>()->floor;
+  auto& occupancy = *level.get_mut<Occupancy>();
+  if (tile == Tile::Floor)
+  {
+    insert_tile(floor, index);
+    if (occupancy.view(pos.y, pos.x) == 0)
+      insert_tile(occupancy.free, index);
+  }
+  else
+  {
+    erase_tile(floor, index);
+    erase_tile(occupancy.free, index);
+  }
+
+  update_regions(*level.get_mut<Regions>(), dd, pos);
+  level.get_mut<ClusterGraph>()->update(dd, pos);
+}
+
+TileSet make_tile_set(const Dungeon& dd)
+{
+  TileSet result
+    {
+      .slots = std::vector<int>(dd.view.size(), TileSet::NONE),
+    };
+  const int width = dd.view.extent(1);
+  for (int y = 0; y < dd.view.extent(0); ++y)
+    for (int x = 0; x < width; x += 64)
+      for (auto open = dd.walkable.row_mask(x, y); open != 0; open &= open - 1)
+        if (const int tx = x + std::countr_zero(open); tx < width)
+          insert_tile(result, y * width + tx);
   return result;
 }
 
+void insert_tile(TileSet& set, int tile)
+{
+  if (set.slots[tile] != TileSet::NONE)
+    return;
+  set.slots[tile] = int(set.tiles.size());
+  set.tiles.push_back(tile);
+}
+
+void erase_tile(TileSet& set, int tile)
+{
+  const int slot = set.slots[tile];
+  if (slot == TileSet::NONE)
+    return;
+  // Fill the hole with the last one
+  set.tiles[slot] = set.tiles.back();
+  set.slots[set.tiles[slot]] = slot;
+  set.tiles.pop_back();
+  set.slots[tile] = TileSet::NONE;
+}
+
+WalkableTiles make_walkable_tiles(const Dungeon& dd)
+{
+  return WalkableTiles{make_tile_set(dd)};
+}
+
+Occupancy make_occupancy(const Dungeon& dd)
+{
+  Occupancy result
+    {
+      .data = std::vector<flecs::entity_t>(dd.view.size(), 0),
+      .free = make_tile_set(dd),
+    };
+  result.view = OccupancyView(result.data.data(), dd.view.extents());
+  return result;
 }
 
+static bool in_bounds(const OccupancyView& view, glm::ivec2 pos)
+{
+  return pos.x >= 0 && pos.x < view.extent(1) && pos.y >= 0 && pos.y < view.extent(0);
+}
+
+flecs::entity_t occupant(const Occupancy& occupancy, glm::ivec2 pos)
+{
+  return in_bounds(occupancy.view, pos) ? occupancy.view(pos.y, pos.x) : 0;
+}
+
+void occupy(Occupancy& occupancy, glm::ivec2 pos, flecs::entity_t who)
+{
+  if (!in_bounds(occupancy.view, pos))
+    return;
+  occupancy.view(pos.y, pos.x) = who;
+  erase_tile(occupancy.free, pos.y * occupancy.view.extent(1) + pos.x);
+}
+
+void vacate(Occupancy& occupancy, glm::ivec2 pos, flecs::entity_t who)
+{
+  if (!in_bounds(occupancy.view, pos) || occupancy.view(pos.y, pos.x) != who)
+    return;
+  occupancy.view(pos.y, pos.x) = 0;
+  // A wall might have been put under the occupant, find_walkable_tile skips those
+  insert_tile(occupancy.free, pos.y * occupancy.view.extent(1) + pos.x);
+}
+
+void add_pickup(Pickups& pickups, glm::ivec2 pos, flecs::entity item)
+{
+  pickups.items.emplace(Pickups::tileKey(pos), item);
+}
+
+void remove_pickup(Pickups& pickups, glm::ivec2 pos, flecs::entity item)
+{
+  auto [b, e] = pickups.items.equal_range(Pickups::tileKey(pos));
+  while (b != e && b->second != item) ++b;
+  if (b != e)
+    pickups.items.erase(b);
+}
+
+flecs::entity dungeon_of(flecs::entity e)
+{
+  if (auto level = e.target<OnLevel>())
+    return level;
+  // Not bound to any level, lives on the current one
+  auto current = e.world().get<CurrentDungeon>();
+  return current ? current->entity : flecs::entity{};
+}
+
+}
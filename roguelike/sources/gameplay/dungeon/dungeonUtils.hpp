@@ -8,8 +8,38 @@
 namespace dungeon
 {
 
+// Random free walkable tile of the largest region of the level.
+// Falls back to occupied tiles when the region is full.
+glm::ivec2 find_walkable_tile(flecs::entity level);
+// Random walkable tile that can be reached from `reachableFrom`
+glm::ivec2 find_walkable_tile(flecs::entity level, glm::ivec2 reachableFrom);
+// Same, on the current dungeon
 glm::ivec2 find_walkable_tile(flecs::world& ecs);
+glm::ivec2 find_walkable_tile(flecs::world& ecs, glm::ivec2 reachableFrom);
 bool is_tile_walkable(const Dungeon& dd, glm::ivec2 pos);
 Dungeon make_dungeon(int width, int height);
 
+// The only way tiles should change after the dungeon entity is created,
+// keeps everything derived from the tiles up to date
+void set_tile(flecs::entity level, glm::ivec2 pos, Tile tile);
+
+TileSet make_tile_set(const Dungeon& dd);
+void insert_tile(TileSet& set, int tile);
+void erase_tile(TileSet& set, int tile);
+WalkableTiles make_walkable_tiles(const Dungeon& dd);
+
+Occupancy make_occupancy(const Dungeon& dd);
+// 0 for free and out of bounds tiles
+flecs::entity_t occupant(const Occupancy& occupancy, glm::ivec2 pos);
+void occupy(Occupancy& occupancy, glm::ivec2 pos, flecs::entity_t who);
+// Only frees the tile if it is still occupied by `who`
+void vacate(Occupancy& occupancy, glm::ivec2 pos, flecs::entity_t who);
+
+void add_pickup(Pickups& pickups, glm::ivec2 pos, flecs::entity item);
+void remove_pickup(Pickups& pickups, glm::ivec2 pos, flecs::entity item);
+
+// Dungeon entity the given entity is bound to with OnLevel,
+// the current one for unbound entities
+flecs::entity dungeon_of(flecs::entity e);
+
 };
@@ -0,0 +1,123 @@
+#include "fov.hpp"
+
+#include <optional>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+// Exact rational slope num / den, den is always positive
+struct Slope
+{
+  int num;
+  int den;
+};
+
+struct Row
+{
+  int depth;
+  Slope start;
+  Slope end;
+};
+
+int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+int ceil_div(int a, int b)
+{
+  return -floor_div(-a, b);
+}
+
+// Maps (depth, column) inside of a quadrant to dungeon coordinates
+glm::ivec2 transform(int quadrant, glm::ivec2 origin, int depth, int col)
+{
+  switch (quadrant)
+  {
+    case 0: return {origin.x + col, origin.y - depth};
+    case 1: return {origin.x + col, origin.y + depth};
+    case 2: return {origin.x + depth, origin.y + col};
+    default: return {origin.x - depth, origin.y + col};
+  }
+}
+
+} // namespace
+
+// See https://www.albertford.com/shadowcasting/
+void compute_fov(const Dungeon& dd, glm::ivec2 origin, int radius, FieldOfView& fov)
+{
+  const int side = 2 * radius + 1;
+  fov.origin = origin;
+  fov.radius = radius;
+  fov.dungeonRevision = dd.revision;
+  fov.bits.assign(radius < 0 ? 0 : (side * side + 63) / 64, 0);
+
+  if (radius < 0)
+    return;
+
+  auto reveal = [&](glm::ivec2 pos)
+    {
+      const auto delta = pos - origin;
+      if (delta.x * delta.x + delta.y * delta.y > radius * radius)
+        return;
+      const auto local = delta + glm::ivec2{radius, radius};
+      const std::size_t idx = local.y * side + local.x;
+      fov.bits[idx / 64] |= std::uint64_t{1} << (idx % 64);
+    };
+
+  auto isWall = [&](glm::ivec2 pos) { return !dd.walkable.walkable_anywhere(pos); };
+
+  reveal(origin);
+
+  // Rows still to be scanned, the algorithm is usually written recursively
+  static thread_local std::vector<Row> rows;
+
+  for (int quadrant = 0; quadrant < 4; ++quadrant)
+  {
+    rows.clear();
+    rows.push_back({1, {-1, 1}, {1, 1}});
+
+    while (!rows.empty())
+    {
+      Row row = rows.back();
+      rows.pop_back();
+
+      if (row.depth > radius)
+        continue;
+
+      // Columns between depth * start and depth * end, rounding ties towards the row's center
+      const int minCol = floor_div(2 * row.depth * row.start.num + row.start.den, 2 * row.start.den);
+      const int maxCol = ceil_div(2 * row.depth * row.end.num - row.end.den, 2 * row.end.den);
+
+      std::optional<bool> prevWall;
+      for (int col = minCol; col <= maxCol; ++col)
+      {
+        const auto pos = transform(quadrant, origin, row.depth, col);
+        const bool wall = isWall(pos);
+        const bool symmetric =
+          col * row.start.den >= row.depth * row.start.num
+          && col * row.end.den <= row.depth * row.end.num;
+
+        if (wall || symmetric)
+          reveal(pos);
+
+        const Slope tileSlope{2 * col - 1, 2 * row.depth};
+        if (prevWall == true && !wall)
+          row.start = tileSlope;
+        if (prevWall == false && wall)
+          rows.push_back({row.depth + 1, row.start, tileSlope});
+
+        prevWall = wall;
+      }
+
+      if (prevWall == false)
+        rows.push_back({row.depth + 1, row.start, row.end});
+    }
+  }
+}
+
+}
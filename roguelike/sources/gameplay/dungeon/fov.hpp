@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+
+
+namespace dungeon
+{
+
+// Tiles visible from `origin`, stored as a bitset over a square window
+// of side 2 * radius + 1 centered at the origin. Cached per entity and
+// only recomputed when the entity moves or the dungeon changes.
+struct FieldOfView
+{
+  glm::ivec2 origin{0, 0};
+  int radius{-1};
+  std::uint32_t dungeonRevision{0};
+  std::vector<std::uint64_t> bits;
+
+  bool visible(glm::ivec2 pos) const
+  {
+    const int side = 2 * radius + 1;
+    const auto local = pos - origin + glm::ivec2{radius, radius};
+    if (radius < 0 || local.x < 0 || local.y < 0 || local.x >= side || local.y >= side)
+      return false;
+    const std::size_t idx = local.y * side + local.x;
+    return (bits[idx / 64] >> (idx % 64)) & 1;
+  }
+
+  bool isUpToDate(glm::ivec2 pos, int r, std::uint32_t revision) const
+  {
+    return origin == pos && radius == r && dungeonRevision == revision;
+  }
+};
+
+// Symmetric shadowcasting limited to a euclidean radius.
+// Walls are visible, tiles outside of the dungeon are walls.
+void compute_fov(const Dungeon& dd, glm::ivec2 origin, int radius, FieldOfView& fov);
+
+}
@@ -0,0 +1,204 @@
+#include "jumpPointSearch.hpp"
+
+#include <bit>
+#include <algorithm>
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+// Arrival directions, the start node has none
+const glm::ivec2 directions[] {{0, 0}, {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+std::uint8_t direction_index(glm::ivec2 dir)
+{
+  return std::uint8_t(std::find(std::begin(directions), std::end(directions), dir) - std::begin(directions));
+}
+
+} // namespace
+
+JumpPointSearch::JumpPointSearch(const Dungeon& dd)
+  : seen_(dd.view.size(), 0)
+  , closed_(dd.view.size(), 0)
+  , cost_(dd.view.size(), 0)
+  , parent_(dd.view.size(), 0)
+  , arrival_(dd.view.size(), 0)
+{
+}
+
+int JumpPointSearch::jumpHorizontal(int x, int y, int dx, glm::ivec2 goal) const
+{
+  constexpr int P = WalkabilityBits::PADDING;
+  const std::uint64_t* walk = bits_->row(y);
+  const std::uint64_t* up = bits_->row(y + 1);
+  const std::uint64_t* down = bits_->row(y - 1);
+  const int words = bits_->wordsPerRow;
+  const int start = x + P;
+  const int goalBit = goal.y == y ? goal.x + P : -1;
+
+  // A tile stops the jump if it is a wall, the goal, or a vertical
+  // neighbor is open while the one behind it is not (a forced turn).
+  // The padding guarantees a wall before we run out of words.
+  auto stopsIn = [&](int w, std::uint64_t upBehind, std::uint64_t downBehind)
+    {
+      std::uint64_t stops = ~walk[w] | (up[w] & ~upBehind) | (down[w] & ~downBehind);
+      if (goalBit >= 0 && goalBit / 64 == w)
+        stops |= std::uint64_t{1} << (goalBit % 64);
+      return stops;
+    };
+
+  auto jumpPointAt = [&](int bit)
+    {
+      return (walk[bit / 64] >> (bit % 64)) & 1 ? bit - P : -1;
+    };
+
+  if (dx > 0)
+  {
+    for (int w = start / 64; w < words; ++w)
+    {
+      const std::uint64_t upBehind = up[w] << 1 | (w > 0 ? up[w - 1] >> 63 : 0);
+      const std::uint64_t downBehind = down[w] << 1 | (w > 0 ? down[w - 1] >> 63 : 0);
+      std::uint64_t stops = stopsIn(w, upBehind, downBehind);
+      if (w == start / 64)
+        stops &= start % 64 == 63 ? 0 : ~std::uint64_t{0} << (start % 64 + 1);
+      if (stops != 0)
+        return jumpPointAt(w * 64 + std::countr_zero(stops));
+    }
+  }
+  else
+  {
+    for (int w = start / 64; w >= 0; --w)
+    {
+      const std::uint64_t upBehind = up[w] >> 1 | (w + 1 < words ? up[w + 1] << 63 : 0);
+      const std::uint64_t downBehind = down[w] >> 1 | (w + 1 < words ? down[w + 1] << 63 : 0);
+      std::uint64_t stops = stopsIn(w, upBehind, downBehind);
+      if (w == start / 64)
+        stops &= (std::uint64_t{1} << (start % 64)) - 1;
+      if (stops != 0)
+        return jumpPointAt(w * 64 + 63 - std::countl_zero(stops));
+    }
+  }
+
+  return -1;
+}
+
+std::optional<glm::ivec2> JumpPointSearch::jumpVertical(glm::ivec2 pos, int dy, glm::ivec2 goal) const
+{
+  for (pos.y += dy; bits_->walkable(pos); pos.y += dy)
+    if (pos == goal || jumpHorizontal(pos.x, pos.y, 1, goal) >= 0 || jumpHorizontal(pos.x, pos.y, -1, goal) >= 0)
+      return pos;
+  return std::nullopt;
+}
+
+void JumpPointSearch::nextGeneration()
+{
+  if (++generation_ != 0)
+    return;
+
+  std::fill(seen_.begin(), seen_.end(), 0);
+  std::fill(closed_.begin(), closed_.end(), 0);
+  generation_ = 1;
+}
+
+bool JumpPointSearch::find_path(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>& out)
+{
+  out.clear();
+  expansions_ = 0;
+
+  if (seen_.size() != dd.view.size())
+    *this = JumpPointSearch(dd);
+  bits_ = &dd.walkable;
+
+  if (!bits_->walkable_anywhere(from) || !bits_->walkable_anywhere(to))
+    return false;
+
+  nextGeneration();
+  open_.clear();
+
+  auto heuristic = [to](glm::ivec2 pos) { return glm::abs(pos.x - to.x) + glm::abs(pos.y - to.y); };
+  auto worse = [](const OpenNode& a, const OpenNode& b) { return a.f > b.f || (a.f == b.f && a.g < b.g); };
+
+  auto relax = [&](glm::ivec2 pos, int parent, int parentCost, glm::ivec2 dir)
+    {
+      const int tile = tileIndex(pos);
+      const int cost = parentCost + glm::abs(pos.x - (parent % bits_->width)) + glm::abs(pos.y - parent / bits_->width);
+      if (closed_[tile] == generation_ || (seen_[tile] == generation_ && cost_[tile] <= cost))
+        return;
+      seen_[tile] = generation_;
+      cost_[tile] = cost;
+      parent_[tile] = parent;
+      arrival_[tile] = direction_index(dir);
+      open_.push_back({cost + heuristic(pos), cost, tile});
+      std::push_heap(open_.begin(), open_.end(), worse);
+    };
+
+  const int start = tileIndex(from);
+  const int goal = tileIndex(to);
+  seen_[start] = generation_;
+  cost_[start] = 0;
+  parent_[start] = start;
+  arrival_[start] = 0;
+  open_.push_back({heuristic(from), 0, start});
+
+  while (!open_.empty())
+  {
+    std::pop_heap(open_.begin(), open_.end(), worse);
+    const auto node = open_.back();
+    open_.pop_back();
+
+    if (closed_[node.tile] == generation_)
+      continue;
+    closed_[node.tile] = generation_;
+    ++expansions_;
+
+    if (node.tile == goal)
+    {
+      // Jump points are connected by straight lines
+      for (int tile = goal; tile != start; tile = parent_[tile])
+        for (auto pos = tilePos(tile), end = tilePos(parent_[tile]); pos != end; pos -= directions[arrival_[tile]])
+          out.push_back(pos);
+      out.push_back(from);
+      std::reverse(out.begin(), out.end());
+      return true;
+    }
+
+    const auto pos = tilePos(node.tile);
+    const auto dir = directions[arrival_[node.tile]];
+
+    auto horizontal = [&](int dx)
+      {
+        if (int x = jumpHorizontal(pos.x, pos.y, dx, to); x >= 0)
+          relax(glm::ivec2{x, pos.y}, node.tile, node.g, glm::ivec2{dx, 0});
+      };
+    auto vertical = [&](int dy)
+      {
+        if (auto jp = jumpVertical(pos, dy, to))
+          relax(*jp, node.tile, node.g, glm::ivec2{0, dy});
+      };
+
+    if (dir.x != 0)
+    {
+      // Horizontal moves only turn where the tile behind blocks the turn
+      horizontal(dir.x);
+      for (int dy : {1, -1})
+        if (bits_->walkable(pos + glm::ivec2{0, dy}) && !bits_->walkable(pos + glm::ivec2{-dir.x, dy}))
+          vertical(dy);
+    }
+    else
+    {
+      horizontal(1);
+      horizontal(-1);
+      if (dir.y >= 0)
+        vertical(1);
+      if (dir.y <= 0)
+        vertical(-1);
+    }
+  }
+
+  return false;
+}
+
+}
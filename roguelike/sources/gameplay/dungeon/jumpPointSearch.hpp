@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+#include "walkability.hpp"
+
+
+namespace dungeon
+{
+
+// Jump point search for 4-connected uniform cost grids. Horizontal moves
+// keep going until a wall, the goal or a forced turn, vertical moves stop
+// wherever a horizontal jump would find something. Horizontal jumps scan
+// whole words of the walkability bits at a time. Produces the same path
+// lengths as plain A* while expanding far fewer nodes in open areas.
+class JumpPointSearch
+{
+public:
+  JumpPointSearch() = default;
+  explicit JumpPointSearch(const Dungeon& dd);
+
+  // Same contract as PathService::find_path
+  bool find_path(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>& out);
+
+  // Nodes expanded by the last query
+  std::size_t expansions() const { return expansions_; }
+
+private:
+  struct OpenNode
+  {
+    int f;
+    int g;
+    int tile;
+  };
+
+  int tileIndex(glm::ivec2 pos) const { return pos.y * bits_->width + pos.x; }
+  glm::ivec2 tilePos(int tile) const { return {tile % bits_->width, tile / bits_->width}; }
+
+  // x of the first jump point past x when moving along the row, -1 if a wall comes first
+  int jumpHorizontal(int x, int y, int dx, glm::ivec2 goal) const;
+  std::optional<glm::ivec2> jumpVertical(glm::ivec2 pos, int dy, glm::ivec2 goal) const;
+  void nextGeneration();
+
+private:
+  // The dungeon's own bits, only valid during find_path
+  const WalkabilityBits* bits_{nullptr};
+
+  std::uint32_t generation_{0};
+  std::vector<std::uint32_t> seen_;
+  std::vector<std::uint32_t> closed_;
+  std::vector<int> cost_;
+  std::vector<int> parent_;
+  // Index of the direction the tile was reached from its parent with
+  std::vector<std::uint8_t> arrival_;
+  std::vector<OpenNode> open_;
+  std::size_t expansions_{0};
+};
+
+}
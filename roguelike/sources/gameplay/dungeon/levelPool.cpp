@@ -0,0 +1,121 @@
+#include "levelPool.hpp"
+
+#include <algorithm>
+#include "dungeonUtils.hpp"
+
+
+namespace dungeon
+{
+
+PreparedLevel prepare_level(Dungeon dd, WorkerPool* workers)
+{
+  // Tiles might have been written through the view
+  dd.walkable = make_walkability(dd);
+  auto regions = make_regions(dd);
+  return prepare_level(std::move(dd), std::move(regions), workers);
+}
+
+PreparedLevel prepare_level(Dungeon dd, Regions regions, WorkerPool* workers)
+{
+  auto walkable = make_walkable_tiles(dd);
+  auto occupancy = make_occupancy(dd);
+  ClusterGraph clusters(dd, workers);
+  return PreparedLevel
+    {
+      .dungeon = std::move(dd),
+      .walkable = std::move(walkable),
+      .occupancy = std::move(occupancy),
+      .regions = std::move(regions),
+      .clusters = std::move(clusters),
+    };
+}
+
+LevelPool::LevelPool(std::shared_ptr<WorkerPool> pool, std::size_t workers)
+  : pool_(std::move(pool))
+{
+  for (std::size_t i = 0; i < workers; ++i)
+    workers_.emplace_back([this]() { work(); });
+}
+
+LevelPool::~LevelPool()
+{
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+std::deque<LevelPool::Entry>::iterator LevelPool::find(const GeneratorParams& params)
+{
+  return std::find_if(entries_.begin(), entries_.end(), [&](const Entry& entry) { return entry.params == params; });
+}
+
+void LevelPool::prefetch(const GeneratorParams& params)
+{
+  {
+    std::lock_guard lock(mutex_);
+    if (find(params) != entries_.end())
+      return;
+    entries_.push_back({params});
+  }
+  queued_.notify_one();
+}
+
+bool LevelPool::ready(const GeneratorParams& params) const
+{
+  std::lock_guard lock(mutex_);
+  return std::any_of(entries_.begin(), entries_.end(),
+    [&](const Entry& entry) { return entry.params == params && entry.level.has_value(); });
+}
+
+PreparedLevel LevelPool::take(const GeneratorParams& params)
+{
+  std::unique_lock lock(mutex_);
+  auto it = find(params);
+  if (it == entries_.end() || !it->started)
+  {
+    // Faster than waiting for the workers to get through the queue
+    if (it != entries_.end())
+      entries_.erase(it);
+    lock.unlock();
+    return prepare_level(generate_dungeon(params, pool_.get()), pool_.get());
+  }
+
+  finished_.wait(lock, [&]() { return find(params)->level.has_value(); });
+  it = find(params);
+  auto result = std::move(*it->level);
+  entries_.erase(it);
+  return result;
+}
+
+void LevelPool::work()
+{
+  std::unique_lock lock(mutex_);
+  while (true)
+  {
+    auto next = entries_.end();
+    queued_.wait(lock,
+      [&]()
+      {
+        next = std::find_if(entries_.begin(), entries_.end(), [](const Entry& entry) { return !entry.started; });
+        return stopping_ || next != entries_.end();
+      });
+    if (stopping_)
+      return;
+
+    next->started = true;
+    const auto params = next->params;
+    lock.unlock();
+    auto level = prepare_level(generate_dungeon(params, pool_.get()), pool_.get());
+    lock.lock();
+
+    // Started entries are only taken once they are finished, so it is still there
+    find(params)->level = std::move(level);
+    finished_.notify_all();
+  }
+}
+
+}
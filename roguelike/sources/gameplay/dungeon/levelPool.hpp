@@ -0,0 +1,79 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <condition_variable>
+
+#include "dungeon.hpp"
+#include "regions.hpp"
+#include "clusterGraph.hpp"
+#include "dungeonGenerator.hpp"
+#include "workerPool.hpp"
+
+
+namespace dungeon
+{
+
+// A level with everything derived from its tiles already computed,
+// only the per-world bookkeeping is left to create_dungeon
+struct PreparedLevel
+{
+  Dungeon dungeon;
+  WalkableTiles walkable;
+  Occupancy occupancy;
+  Regions regions;
+  ClusterGraph clusters;
+};
+
+PreparedLevel prepare_level(Dungeon dd, WorkerPool* workers = nullptr);
+// Takes the walkability bits and regions that came with the tiles as
+// they are, like the ones of a dungeon file
+PreparedLevel prepare_level(Dungeon dd, Regions regions, WorkerPool* workers = nullptr);
+
+// Generates and prepares levels on worker threads ahead of time, so that
+// changing levels never waits on generation. Levels are keyed by their
+// generator params, the seed included. Generating and preparing a level
+// gets split between the shared pool's workers, when it is not busy with a turn.
+class LevelPool
+{
+public:
+  explicit LevelPool(std::shared_ptr<WorkerPool> pool = nullptr, std::size_t workers = 1);
+  ~LevelPool();
+
+  LevelPool(const LevelPool&) = delete;
+  LevelPool& operator=(const LevelPool&) = delete;
+
+  // Queues the level unless it is already queued or ready
+  void prefetch(const GeneratorParams& params);
+  bool ready(const GeneratorParams& params) const;
+
+  // Waits for a level that is being generated, generates it on the
+  // calling thread if no worker got to it yet
+  PreparedLevel take(const GeneratorParams& params);
+
+private:
+  struct Entry
+  {
+    GeneratorParams params;
+    bool started{false};
+    std::optional<PreparedLevel> level;
+  };
+
+  std::deque<Entry>::iterator find(const GeneratorParams& params);
+  void work();
+
+private:
+  mutable std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable finished_;
+  std::deque<Entry> entries_;
+  bool stopping_{false};
+  std::shared_ptr<WorkerPool> pool_;
+  std::vector<std::thread> workers_;
+};
+
+}
@@ -0,0 +1,184 @@
+#include "moveReservations.hpp"
+
+#include <atomic>
+#include <assert.hpp>
+#include "dungeonUtils.hpp"
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+constexpr std::uint32_t NONE = MoveReservations::NONE;
+// Fewer agents than this are done before the workers would even wake up
+constexpr std::uint32_t PARALLEL_MIN = 2048;
+
+bool in_bounds(const Dungeon& dd, glm::ivec2 pos)
+{
+  return pos.x >= 0 && pos.x < dd.view.extent(1) && pos.y >= 0 && pos.y < dd.view.extent(0);
+}
+
+std::size_t tile_index(const Dungeon& dd, glm::ivec2 pos)
+{
+  return std::size_t(pos.y) * dd.view.extent(1) + pos.x;
+}
+
+// Calls fn(begin, end) once per worker on contiguous ranges of [0, count)
+template<class Fn>
+void for_ranges(WorkerPool* workers, std::uint32_t count, Fn&& fn)
+{
+  if (!workers)
+  {
+    fn(std::uint32_t{0}, count);
+    return;
+  }
+
+  const auto ranges = std::uint64_t(workers->size());
+  workers->run(
+    [&](std::size_t worker)
+    {
+      fn(std::uint32_t(count * worker / ranges), std::uint32_t(count * (worker + 1) / ranges));
+    });
+}
+
+// Keeps whichever request wins the tile, no matter who gets there first
+template<class Wins>
+void claim_tile(std::uint32_t& tile, std::uint32_t i, Wins wins)
+{
+  std::atomic_ref slot(tile);
+  auto current = slot.load(std::memory_order_relaxed);
+  while ((current == NONE || wins(i, current))
+    && !slot.compare_exchange_weak(current, i, std::memory_order_relaxed))
+    ;
+}
+
+} // namespace
+
+MoveReservations make_move_reservations(const Dungeon& dd)
+{
+  return MoveReservations
+    {
+      .claims = std::vector<std::uint32_t>(dd.view.size(), NONE),
+      .standing = std::vector<std::uint32_t>(dd.view.size(), NONE),
+    };
+}
+
+void resolve_moves(MoveReservations& reservations, const Dungeon& dd, const Occupancy& occupancy,
+  std::span<const MoveRequest> requests, std::span<MoveResult> results, WorkerPool& pool)
+{
+  NG_ASSERT(requests.size() == results.size());
+  NG_ASSERT(reservations.claims.size() == dd.view.size());
+
+  const auto count = std::uint32_t(requests.size());
+  auto& claims = reservations.claims;
+  auto& standing = reservations.standing;
+  auto& moving = reservations.moving;
+  auto& nextMoving = reservations.nextMoving;
+  moving.assign(count, 0);
+  nextMoving.assign(count, 0);
+
+  // Every run is a barrier, the next phase sees everything the previous one wrote
+  WorkerPool* workers = count >= PARALLEL_MIN ? &pool : nullptr;
+
+  auto wantsToMove = [&](const MoveRequest& req)
+    {
+      return req.to != req.from && is_tile_walkable(dd, req.to);
+    };
+
+  // Phase 1: every agent marks the tile it stands on and reserves its target.
+  // Of agents spawned on top of each other the last request counts as standing.
+  for_ranges(workers, count,
+    [&](std::uint32_t begin, std::uint32_t end)
+    {
+      for (std::uint32_t i = begin; i < end; ++i)
+      {
+        const auto& req = requests[i];
+        if (in_bounds(dd, req.from))
+          claim_tile(standing[tile_index(dd, req.from)], i,
+            [](std::uint32_t next, std::uint32_t current) { return next > current; });
+        if (wantsToMove(req))
+          claim_tile(claims[tile_index(dd, req.to)], i,
+            [&](std::uint32_t next, std::uint32_t current) { return requests[current].agent > requests[next].agent; });
+      }
+    });
+
+  for_ranges(workers, count,
+    [&](std::uint32_t begin, std::uint32_t end)
+    {
+      for (std::uint32_t i = begin; i < end; ++i)
+        moving[i] = wantsToMove(requests[i]) && claims[tile_index(dd, requests[i].to)] == i;
+    });
+
+  // Phase 2: a claim only goes through if the target gets vacated.
+  // Every pass reads the previous pass' state and agents only ever go from
+  // moving to blocked, so a chain of followers settles in at most its length passes.
+  for (std::atomic<bool> changed{true}; changed.load(std::memory_order_relaxed);)
+  {
+    changed.store(false, std::memory_order_relaxed);
+    for_ranges(workers, count,
+      [&](std::uint32_t begin, std::uint32_t end)
+      {
+        bool blocked = false;
+        for (std::uint32_t i = begin; i < end; ++i)
+        {
+          if (!moving[i])
+          {
+            nextMoving[i] = 0;
+            continue;
+          }
+
+          const auto& req = requests[i];
+          const auto stander = standing[tile_index(dd, req.to)];
+          const bool vacated = stander == NONE
+            // Somebody who does not take part in movement this turn
+            ? occupant(occupancy, req.to) == 0
+            : moving[stander] && requests[stander].to != req.from;
+
+          nextMoving[i] = vacated;
+          blocked |= !vacated;
+        }
+        if (blocked)
+          changed.store(true, std::memory_order_relaxed);
+      });
+    std::swap(moving, nextMoving);
+  }
+
+  // Phase 3: blocked agents bump whoever ends up on their target tile
+  for_ranges(workers, count,
+    [&](std::uint32_t begin, std::uint32_t end)
+    {
+      for (std::uint32_t i = begin; i < end; ++i)
+      {
+        const auto& req = requests[i];
+        results[i] = MoveResult{.moved = moving[i] != 0};
+        if (moving[i] || !wantsToMove(req))
+          continue;
+
+        const auto tile = tile_index(dd, req.to);
+        if (const auto claim = claims[tile]; moving[claim])
+          results[i].bumped = requests[claim].agent;
+        else if (const auto stander = standing[tile]; stander != NONE)
+          results[i].bumped = moving[stander] ? 0 : requests[stander].agent;
+        else
+          results[i].bumped = occupant(occupancy, req.to);
+      }
+    });
+
+  // Leave the tables clean for the next turn, several agents can share a tile
+  for_ranges(workers, count,
+    [&](std::uint32_t begin, std::uint32_t end)
+    {
+      for (std::uint32_t i = begin; i < end; ++i)
+      {
+        const auto& req = requests[i];
+        if (in_bounds(dd, req.from))
+          std::atomic_ref(standing[tile_index(dd, req.from)]).store(NONE, std::memory_order_relaxed);
+        if (in_bounds(dd, req.to))
+          std::atomic_ref(claims[tile_index(dd, req.to)]).store(NONE, std::memory_order_relaxed);
+      }
+    });
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <flecs.h>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+#include "workerPool.hpp"
+
+
+namespace dungeon
+{
+
+struct MoveRequest
+{
+  flecs::entity_t agent;
+  glm::ivec2 from;
+  // Same as from when the agent does not want to move
+  glm::ivec2 to;
+};
+
+struct MoveResult
+{
+  bool moved{false};
+  // Who the agent bumped into when its move got blocked by somebody, 0 otherwise
+  flecs::entity_t bumped{0};
+};
+
+// Lives on the dungeon entity. Per-tile scratch tables for resolving
+// all moves of a turn at once, kept between turns so that resolution
+// does not allocate. Every tile holds NONE between turns.
+struct MoveReservations
+{
+  static constexpr std::uint32_t NONE = ~std::uint32_t{0};
+
+  // Request index of the highest priority claim on each tile
+  std::vector<std::uint32_t> claims;
+  // Request index of the agent standing on each tile when the turn begins
+  std::vector<std::uint32_t> standing;
+  std::vector<std::uint8_t> moving;
+  std::vector<std::uint8_t> nextMoving;
+};
+
+MoveReservations make_move_reservations(const Dungeon& dd);
+
+// Resolves the moves of all agents simultaneously. The agent with the
+// lowest entity id wins a contested tile, a move only goes through if
+// the target tile gets vacated this turn, swaps are never allowed.
+// Blocked agents bump whoever ends up on their target tile.
+// Every phase is a loop over agents that only writes to the agent's own
+// slot (or takes a min over the tile tables), so the result does not
+// depend on the order of the requests and every phase gets split into
+// ranges of agents across the workers.
+void resolve_moves(MoveReservations& reservations, const Dungeon& dd, const Occupancy& occupancy,
+  std::span<const MoveRequest> requests, std::span<MoveResult> results, WorkerPool& workers);
+
+}
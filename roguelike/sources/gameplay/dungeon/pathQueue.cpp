@@ -0,0 +1,194 @@
+#include "pathQueue.hpp"
+
+#include <tuple>
+#include <atomic>
+#include <algorithm>
+#include "dungeonUtils.hpp"
+
+
+namespace dungeon
+{
+
+void PathQueue::submit(flecs::entity_t agent, glm::ivec2 from, flecs::entity_t target, glm::ivec2 targetPos)
+{
+  if (auto it = byAgent_.find(agent); it != byAgent_.end())
+  {
+    auto& request = requests_[it->second];
+    // Waiting for something else now, so the wait starts over
+    if (request.target != target)
+      request.turn = turn_;
+    request.from = from;
+    request.target = target;
+    request.targetPos = targetPos;
+    return;
+  }
+
+  byAgent_.emplace(agent, requests_.size());
+  requests_.push_back({agent, from, target, targetPos, turn_});
+}
+
+void PathQueue::moved(flecs::entity_t agent, glm::ivec2 pos)
+{
+  if (auto it = byAgent_.find(agent); it != byAgent_.end())
+    requests_[it->second].from = pos;
+}
+
+bool PathQueue::serveGroup(const Dungeon& dd, Scratch& scratch, Group group,
+  std::chrono::steady_clock::time_point deadline)
+{
+  const int width = dd.view.extent(1);
+  const auto tileOf = [width](glm::ivec2 pos) { return pos.y * width + pos.x; };
+  const auto posOf = [width](int tile) { return glm::ivec2{tile % width, tile / width}; };
+
+  if (scratch.seen.size() != dd.view.size())
+  {
+    scratch.seen.assign(dd.view.size(), 0);
+    scratch.wanted.assign(dd.view.size(), 0);
+    scratch.parent.assign(dd.view.size(), 0);
+    scratch.generation = 0;
+  }
+  if (++scratch.generation == 0)
+  {
+    std::fill(scratch.seen.begin(), scratch.seen.end(), 0);
+    std::fill(scratch.wanted.begin(), scratch.wanted.end(), 0);
+    scratch.generation = 1;
+  }
+  const auto gen = scratch.generation;
+
+  std::size_t remaining = 0;
+  for (std::size_t i = group.begin; i < group.end; ++i)
+  {
+    const auto from = requests_[i].from;
+    if (is_tile_walkable(dd, from) && scratch.wanted[tileOf(from)] != gen)
+    {
+      scratch.wanted[tileOf(from)] = gen;
+      ++remaining;
+    }
+  }
+
+  // Search from the target, parents point towards it
+  const auto goal = requests_[group.begin].targetPos;
+  scratch.queue.clear();
+  if (is_tile_walkable(dd, goal))
+  {
+    scratch.seen[tileOf(goal)] = gen;
+    scratch.parent[tileOf(goal)] = tileOf(goal);
+    scratch.queue.push_back(tileOf(goal));
+    remaining -= scratch.wanted[tileOf(goal)] == gen;
+  }
+
+  // Checking the clock is not free, so it only happens every so many tiles
+  constexpr std::size_t DEADLINE_CHECK_INTERVAL = 1024;
+  static const glm::ivec2 neighbors[] {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  for (std::size_t head = 0; head < scratch.queue.size() && remaining > 0; ++head)
+  {
+    if (head % DEADLINE_CHECK_INTERVAL == DEADLINE_CHECK_INTERVAL - 1 && std::chrono::steady_clock::now() >= deadline)
+      return false;
+
+    const int cur = scratch.queue[head];
+    for (auto delta : neighbors)
+    {
+      const auto next = posOf(cur) + delta;
+      if (!dd.walkable.walkable(next) || scratch.seen[tileOf(next)] == gen)
+        continue;
+      scratch.seen[tileOf(next)] = gen;
+      scratch.parent[tileOf(next)] = cur;
+      scratch.queue.push_back(tileOf(next));
+      remaining -= scratch.wanted[tileOf(next)] == gen;
+    }
+  }
+
+  for (std::size_t i = group.begin; i < group.end; ++i)
+  {
+    auto& path = found_[i];
+    path.clear();
+    const auto from = requests_[i].from;
+    if (!is_tile_walkable(dd, from) || scratch.seen[tileOf(from)] != gen)
+      continue;
+
+    for (int tile = tileOf(from); tile != tileOf(goal); tile = scratch.parent[tile])
+      path.push_back(posOf(tile));
+    path.push_back(goal);
+  }
+  return true;
+}
+
+std::size_t PathQueue::serve(const Dungeon& dd, PathService& paths, ClusterGraph* clusters, WorkerPool& workers,
+  std::chrono::microseconds budget)
+{
+  const auto deadline = std::chrono::steady_clock::now() + budget;
+  ++turn_;
+
+  if (requests_.empty())
+    return 0;
+
+  // Long range requests go through the cluster graph one by one,
+  // everything else gets grouped by target
+  auto longRange = [&](const Request& r) { return clusters && clusters->is_long_range(r.from, r.targetPos); };
+  std::stable_sort(requests_.begin(), requests_.end(),
+    [&](const Request& a, const Request& b)
+    {
+      return std::tuple{longRange(a), a.target, a.turn} < std::tuple{longRange(b), b.target, b.turn};
+    });
+
+  groups_.clear();
+  std::size_t shortRange = 0;
+  while (shortRange < requests_.size() && !longRange(requests_[shortRange]))
+  {
+    std::size_t end = shortRange + 1;
+    while (end < requests_.size() && !longRange(requests_[end]) && requests_[end].target == requests_[shortRange].target)
+      ++end;
+    groups_.push_back({shortRange, end});
+    shortRange = end;
+  }
+  // Groups are sorted by turn inside, the oldest request of a group is its first one
+  std::stable_sort(groups_.begin(), groups_.end(),
+    [this](const Group& a, const Group& b) { return requests_[a.begin].turn < requests_[b.begin].turn; });
+
+  if (found_.size() < requests_.size())
+    found_.resize(requests_.size());
+  served_.assign(requests_.size(), 0);
+
+  if (scratch_.size() < workers.size())
+    scratch_.resize(workers.size());
+
+  std::atomic<std::size_t> nextGroup{0};
+  workers.run(
+    [&](std::size_t worker)
+    {
+      while (std::chrono::steady_clock::now() < deadline)
+      {
+        const std::size_t g = nextGroup++;
+        if (g >= groups_.size())
+          return;
+        if (serveGroup(dd, scratch_[worker], groups_[g], deadline))
+          std::fill(served_.begin() + groups_[g].begin, served_.begin() + groups_[g].end, 1);
+      }
+    });
+
+  // The path service is not thread safe, so the results go in from here
+  for (std::size_t i = 0; i < shortRange; ++i)
+    if (served_[i])
+      paths.store(dd, requests_[i].from, requests_[i].target, requests_[i].targetPos, found_[i]);
+
+  for (std::size_t i = shortRange; i < requests_.size() && std::chrono::steady_clock::now() < deadline; ++i)
+  {
+    paths.next_step(dd, clusters, requests_[i].from, requests_[i].target, requests_[i].targetPos);
+    served_[i] = 1;
+  }
+
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < requests_.size(); ++i)
+    if (!served_[i])
+      requests_[kept++] = requests_[i];
+  const std::size_t servedCount = requests_.size() - kept;
+  requests_.resize(kept);
+
+  byAgent_.clear();
+  for (std::size_t i = 0; i < requests_.size(); ++i)
+    byAgent_.emplace(requests_[i].agent, i);
+
+  return servedCount;
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <flecs.h>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+#include "pathfinding.hpp"
+#include "clusterGraph.hpp"
+#include "workerPool.hpp"
+
+
+namespace dungeon
+{
+
+// Lives on the dungeon entity. Agents submit path requests while picking
+// their actions and keep following their last path (or walk straight at
+// the target) until the request gets served at the end of the turn.
+// Requests for the same target are served together by a single search
+// from the target, different targets get searched in parallel on the
+// shared worker pool, and serving stops once the turn's time
+// budget runs out, in the middle of a search if need be. Whatever is
+// left waits for the next turn, oldest requests go first.
+class PathQueue
+{
+public:
+  static constexpr std::chrono::microseconds TURN_BUDGET{2000};
+
+  // An agent only ever has a single pending request, resubmitting replaces it
+  void submit(flecs::entity_t agent, glm::ivec2 from, flecs::entity_t target, glm::ivec2 targetPos);
+  // Agents keep moving while they wait, searching from where they were is pointless
+  void moved(flecs::entity_t agent, glm::ivec2 pos);
+
+  // Puts the found paths into the path service, returns how many requests were served
+  std::size_t serve(const Dungeon& dd, PathService& paths, ClusterGraph* clusters, WorkerPool& workers,
+    std::chrono::microseconds budget = TURN_BUDGET);
+
+  std::size_t pending() const { return requests_.size(); }
+
+private:
+  struct Request
+  {
+    flecs::entity_t agent;
+    glm::ivec2 from;
+    flecs::entity_t target;
+    glm::ivec2 targetPos;
+    // Turn the agent first asked on
+    std::uint32_t turn;
+  };
+
+  // Requests [begin, end) all share the target
+  struct Group
+  {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  // Breadth first search state of a single worker
+  struct Scratch
+  {
+    std::uint32_t generation{0};
+    std::vector<std::uint32_t> seen;
+    std::vector<std::uint32_t> wanted;
+    std::vector<int> parent;
+    std::vector<int> queue;
+  };
+
+  // False when the deadline came first, nothing gets written then
+  bool serveGroup(const Dungeon& dd, Scratch& scratch, Group group,
+    std::chrono::steady_clock::time_point deadline);
+
+private:
+  std::uint32_t turn_{0};
+  std::vector<Request> requests_;
+  std::unordered_map<flecs::entity_t, std::size_t> byAgent_;
+
+  // Reused between turns, indexed like requests_ while serving
+  std::vector<Group> groups_;
+  std::vector<std::vector<glm::ivec2>> found_;
+  std::vector<std::uint8_t> served_;
+  std::vector<Scratch> scratch_;
+};
+
+}
@@ -0,0 +1,242 @@
+#include "pathfinding.hpp"
+
+#include <algorithm>
+#include "dungeonUtils.hpp"
+#include "regions.hpp"
+#include "pathQueue.hpp"
+
+
+namespace dungeon
+{
+
+PathService::PathService(DungeonView dungeon)
+  : width_{dungeon.extent(1)}
+  , height_{dungeon.extent(0)}
+  , seen_(dungeon.size(), 0)
+  , closed_(dungeon.size(), 0)
+  , cost_(dungeon.size(), 0)
+  , parent_(dungeon.size(), 0)
+  , cache_(CACHE_SIZE)
+{
+}
+
+int PathService::regionOf(glm::ivec2 pos) const
+{
+  const int regionsX = (width_ + REGION_SIZE - 1) / REGION_SIZE;
+  return pos.y / REGION_SIZE * regionsX + pos.x / REGION_SIZE;
+}
+
+void PathService::nextGeneration()
+{
+  if (++generation_ != 0)
+    return;
+
+  // Stamps wrapped around, old ones could alias the new generation
+  std::fill(seen_.begin(), seen_.end(), 0);
+  std::fill(closed_.begin(), closed_.end(), 0);
+  generation_ = 1;
+}
+
+PathService::CachedPath* PathService::findSlot(int region, flecs::entity_t target, CachedPath** victim)
+{
+  const std::size_t hash = std::hash<flecs::entity_t>{}(target) * 31 + std::size_t(region);
+  const std::size_t set = hash % (CACHE_SIZE / CACHE_WAYS) * CACHE_WAYS;
+
+  if (victim)
+    *victim = &cache_[set];
+  for (std::size_t i = set; i < set + CACHE_WAYS; ++i)
+  {
+    auto& entry = cache_[i];
+    if (entry.target == target && entry.region == region)
+      return &entry;
+    if (victim && entry.lastUsed < (*victim)->lastUsed)
+      *victim = &entry;
+  }
+  return nullptr;
+}
+
+PathService::CachedPath& PathService::cacheSlot(int region, flecs::entity_t target)
+{
+  // Either the path we are looking for or the least recently used one
+  CachedPath* victim = nullptr;
+  if (auto entry = findSlot(region, target, &victim))
+    return *entry;
+
+  victim->target = target;
+  victim->region = region;
+  victim->dungeonRevision = ~std::uint32_t{0};
+  victim->tiles.clear();
+  return *victim;
+}
+
+bool PathService::find_path(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>& out)
+{
+  out.clear();
+  expansions_ = 0;
+  if (!is_tile_walkable(dd, from) || !is_tile_walkable(dd, to))
+    return false;
+
+  nextGeneration();
+  open_.clear();
+
+  auto heuristic = [to](glm::ivec2 pos) { return glm::abs(pos.x - to.x) + glm::abs(pos.y - to.y); };
+  // Min-heap on f, prefers nodes further along the path on ties
+  auto worse = [](const OpenNode& a, const OpenNode& b) { return a.f > b.f || (a.f == b.f && a.g < b.g); };
+
+  const int start = tileIndex(from);
+  const int goal = tileIndex(to);
+  seen_[start] = generation_;
+  cost_[start] = 0;
+  parent_[start] = start;
+  open_.push_back({heuristic(from), 0, start});
+
+  static const glm::ivec2 neighbors[] {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+  while (!open_.empty())
+  {
+    std::pop_heap(open_.begin(), open_.end(), worse);
+    const auto node = open_.back();
+    open_.pop_back();
+
+    // Stale duplicate of an already expanded tile
+    if (closed_[node.tile] == generation_)
+      continue;
+    closed_[node.tile] = generation_;
+    ++expansions_;
+
+    if (node.tile == goal)
+    {
+      for (int tile = goal; tile != start; tile = parent_[tile])
+        out.push_back(tilePos(tile));
+      out.push_back(from);
+      std::reverse(out.begin(), out.end());
+      return true;
+    }
+
+    const auto pos = tilePos(node.tile);
+    for (auto delta : neighbors)
+    {
+      const auto next = pos + delta;
+      if (!dd.walkable.walkable(next))
+        continue;
+
+      const int tile = tileIndex(next);
+      const int cost = node.g + 1;
+      if (closed_[tile] == generation_ || (seen_[tile] == generation_ && cost_[tile] <= cost))
+        continue;
+
+      seen_[tile] = generation_;
+      cost_[tile] = cost;
+      parent_[tile] = node.tile;
+      open_.push_back({cost + heuristic(next), cost, tile});
+      std::push_heap(open_.begin(), open_.end(), worse);
+    }
+  }
+
+  return false;
+}
+
+std::optional<glm::ivec2> PathService::cached_step(const Dungeon& dd, glm::ivec2 from,
+  flecs::entity_t target, glm::ivec2 targetPos, bool& fresh)
+{
+  fresh = false;
+  auto entry = findSlot(regionOf(from), target, nullptr);
+  if (!entry || entry->dungeonRevision != dd.revision)
+    return std::nullopt;
+  entry->lastUsed = ++clock_;
+
+  const auto targetDelta = glm::abs(entry->targetPos - targetPos);
+  const bool closeEnough = std::max(targetDelta.x, targetDelta.y) <= RETARGET_DISTANCE;
+
+  if (!entry->reachable)
+  {
+    fresh = closeEnough && entry->start == from;
+    return std::nullopt;
+  }
+
+  // Agents from the same region usually join a path near its start.
+  // Past the end of a path the target has moved, so it is not fresh anymore.
+  auto it = std::find(entry->tiles.begin(), entry->tiles.end(), from);
+  if (it == entry->tiles.end() || std::next(it) == entry->tiles.end() || *std::next(it) == PATH_SEPARATOR)
+    return std::nullopt;
+
+  fresh = closeEnough;
+  return *std::next(it);
+}
+
+void PathService::store(const Dungeon& dd, glm::ivec2 from, flecs::entity_t target, glm::ivec2 targetPos,
+  std::span<const glm::ivec2> tiles)
+{
+  auto& entry = cacheSlot(regionOf(from), target);
+  entry.lastUsed = ++clock_;
+
+  // Paths to the same spot from the same region live side by side,
+  // so that agents in the region don't keep replacing each other's paths
+  const bool append = entry.reachable && !tiles.empty()
+    && entry.dungeonRevision == dd.revision && entry.targetPos == targetPos
+    && entry.tiles.size() + tiles.size() < MAX_CACHED_TILES;
+  if (append)
+    entry.tiles.push_back(PATH_SEPARATOR);
+  else
+    entry.tiles.clear();
+
+  entry.tiles.insert(entry.tiles.end(), tiles.begin(), tiles.end());
+  entry.start = from;
+  entry.targetPos = targetPos;
+  entry.dungeonRevision = dd.revision;
+  entry.reachable = !tiles.empty();
+}
+
+std::optional<glm::ivec2> PathService::next_step(const Dungeon& dd, ClusterGraph* clusters, glm::ivec2 from,
+  flecs::entity_t target, glm::ivec2 targetPos)
+{
+  if (from == targetPos)
+    return std::nullopt;
+
+  bool fresh = false;
+  if (auto step = cached_step(dd, from, target, targetPos, fresh); fresh)
+    return step;
+
+  // Cached paths of long range queries end at the next cluster,
+  // walking past their end triggers the next refinement
+  auto goal = std::optional{targetPos};
+  if (clusters && clusters->is_long_range(from, targetPos))
+    goal = clusters->next_waypoint(dd, from, targetPos);
+
+  if (!goal || !jumpPoints_.find_path(dd, from, *goal, path_))
+    path_.clear();
+  store(dd, from, target, targetPos, path_);
+
+  if (path_.size() < 2)
+    return std::nullopt;
+  return path_[1];
+}
+
+glm::ivec2 next_path_step(flecs::entity agent, glm::ivec2 from, flecs::entity target, glm::ivec2 targetPos)
+{
+  auto level = dungeon_of(agent);
+  auto paths = level ? level.get_mut<PathService>() : nullptr;
+  if (!paths)
+    return targetPos;
+
+  // Don't bother searching the whole region to prove what the labels already know
+  if (auto regions = level.get<Regions>(); regions && !reachable(*regions, from, targetPos))
+    return targetPos;
+
+  const auto& dd = *level.get<Dungeon>();
+  auto queue = level.get_mut<PathQueue>();
+  if (!queue)
+  {
+    auto step = paths->next_step(dd, level.get_mut<ClusterGraph>(), from, target.id(), targetPos);
+    return step ? *step : targetPos;
+  }
+
+  // Searching happens at the end of the turn, until then the old path will do
+  bool fresh = false;
+  auto step = paths->cached_step(dd, from, target.id(), targetPos, fresh);
+  if (!fresh && from != targetPos)
+    queue->submit(agent.id(), from, target.id(), targetPos);
+  return step ? *step : targetPos;
+}
+
+}
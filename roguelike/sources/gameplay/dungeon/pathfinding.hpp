@@ -0,0 +1,121 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <flecs.h>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+#include "clusterGraph.hpp"
+#include "jumpPointSearch.hpp"
+
+
+namespace dungeon
+{
+
+// Lives on the dungeon entity. Path search over the tiles of the dungeon
+// that keeps all of its search state between queries, so that a query
+// does not allocate once the buffers have grown. Recent paths are cached by
+// the start region and the target, agents chasing the same target from
+// the same part of the map share a single search.
+class PathService
+{
+public:
+  static constexpr int REGION_SIZE = 8;
+  // A cached path gets recomputed once its target has moved further than this
+  static constexpr int RETARGET_DISTANCE = 3;
+  static constexpr std::size_t CACHE_SIZE = 256;
+  static constexpr std::size_t CACHE_WAYS = 4;
+  // Paths sharing a cache slot get dropped once they grow past this
+  static constexpr std::size_t MAX_CACHED_TILES = 1024;
+
+  PathService() = default;
+  explicit PathService(DungeonView dungeon);
+
+  // Next tile on the way from `from` to `target` which currently stands
+  // on `targetPos`, nullopt if there is no path or we are already there.
+  // Long range queries only refine the way up to the next cluster when
+  // a cluster graph is given.
+  std::optional<glm::ivec2> next_step(const Dungeon& dd, ClusterGraph* clusters, glm::ivec2 from,
+    flecs::entity_t target, glm::ivec2 targetPos);
+
+  // Step along a cached path without searching. Stale paths are still
+  // worth following while a fresh one is being looked for, `fresh` tells
+  // whether that is needed. A fresh nullopt means a known dead end.
+  std::optional<glm::ivec2> cached_step(const Dungeon& dd, glm::ivec2 from,
+    flecs::entity_t target, glm::ivec2 targetPos, bool& fresh);
+
+  // Caches a path from `from` to `target` that was found elsewhere,
+  // an empty path marks the target as unreachable
+  void store(const Dungeon& dd, glm::ivec2 from, flecs::entity_t target, glm::ivec2 targetPos,
+    std::span<const glm::ivec2> tiles);
+
+  // Plain A*, writes the path from `from` to `to` (both inclusive)
+  // into out, returns false if `to` is unreachable.
+  // Queries made by next_step go through jump point search instead.
+  bool find_path(const Dungeon& dd, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>& out);
+
+  // Nodes expanded by the last find_path
+  std::size_t expansions() const { return expansions_; }
+
+private:
+  struct CachedPath
+  {
+    flecs::entity_t target{0};
+    int region{-1};
+    glm::ivec2 start{0, 0};
+    glm::ivec2 targetPos{0, 0};
+    std::uint32_t dungeonRevision{0};
+    std::uint32_t lastUsed{0};
+    bool reachable{false};
+    // One or more paths towards the target, separated by PATH_SEPARATOR
+    std::vector<glm::ivec2> tiles;
+  };
+
+  static inline const glm::ivec2 PATH_SEPARATOR{-1, -1};
+
+  struct OpenNode
+  {
+    int f;
+    int g;
+    int tile;
+  };
+
+  int tileIndex(glm::ivec2 pos) const { return pos.y * width_ + pos.x; }
+  glm::ivec2 tilePos(int tile) const { return {tile % width_, tile / width_}; }
+  int regionOf(glm::ivec2 pos) const;
+  void nextGeneration();
+  // Sets victim to the least recently used entry of the set on a miss
+  CachedPath* findSlot(int region, flecs::entity_t target, CachedPath** victim);
+  CachedPath& cacheSlot(int region, flecs::entity_t target);
+
+private:
+  int width_{0};
+  int height_{0};
+
+  // Per-tile search state is only valid when stamped with the current
+  // generation, so nothing has to be cleared between searches
+  std::uint32_t generation_{0};
+  std::vector<std::uint32_t> seen_;
+  std::vector<std::uint32_t> closed_;
+  std::vector<int> cost_;
+  std::vector<int> parent_;
+  std::vector<OpenNode> open_;
+  std::size_t expansions_{0};
+
+  JumpPointSearch jumpPoints_;
+  std::vector<glm::ivec2> path_;
+
+  std::uint32_t clock_{0};
+  std::vector<CachedPath> cache_;
+};
+
+// Next tile for `agent` to step on on its way to `target`. Falls back to
+// the target position itself when there is no path, so that move_towards
+// degrades into the greedy approach. With a PathQueue on the level the
+// search is only requested here and the last known path is followed meanwhile.
+glm::ivec2 next_path_step(flecs::entity agent, glm::ivec2 from, flecs::entity target, glm::ivec2 targetPos);
+
+}
@@ -0,0 +1,177 @@
+#include "regions.hpp"
+
+#include <bit>
+#include <utility>
+#include <algorithm>
+#include "dungeonUtils.hpp"
+
+
+namespace dungeon
+{
+
+namespace
+{
+
+const glm::ivec2 neighbors[] {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+bool in_bounds(const Regions& regions, glm::ivec2 pos)
+{
+  return pos.x >= 0 && pos.x < regions.view.extent(1) && pos.y >= 0 && pos.y < regions.view.extent(0);
+}
+
+// Labels everything connected to `from` that is not labeled `label` yet
+void flood(Regions& regions, const Dungeon& dd, glm::ivec2 from, std::uint32_t label)
+{
+  auto relabel = [&](glm::ivec2 pos)
+    {
+      auto& current = regions.view(pos.y, pos.x);
+      if (current != Regions::NONE)
+        --regions.sizes[current];
+      current = label;
+      ++regions.sizes[label];
+      regions.stack.push_back(pos);
+    };
+
+  regions.stack.clear();
+  relabel(from);
+
+  while (!regions.stack.empty())
+  {
+    const auto pos = regions.stack.back();
+    regions.stack.pop_back();
+    for (auto delta : neighbors)
+    {
+      const auto next = pos + delta;
+      if (dd.walkable.walkable(next) && regions.view(next.y, next.x) != label)
+        relabel(next);
+    }
+  }
+}
+
+// Whether the walkable neighbors of pos are connected to each other by
+// the tiles around it, then pos can't have split them apart
+bool connected_around(const Dungeon& dd, glm::ivec2 pos)
+{
+  // Every other one is a neighbor, every one touches the next
+  static const glm::ivec2 ring[] {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+
+  int start = 0;
+  while (start < 8 && dd.walkable.walkable(pos + ring[start]))
+    ++start;
+  if (start == 8)
+    return true;
+
+  // Runs of walkable tiles around pos that hold a neighbor
+  int runs = 0;
+  bool counted = false;
+  for (int i = 1; i <= 8; ++i)
+  {
+    const int k = (start + i) % 8;
+    if (!dd.walkable.walkable(pos + ring[k]))
+      counted = false;
+    else if (k % 2 == 0 && !std::exchange(counted, true))
+      ++runs;
+  }
+  return runs <= 1;
+}
+
+std::uint32_t new_label(Regions& regions)
+{
+  regions.sizes.push_back(0);
+  return std::uint32_t(regions.sizes.size() - 1);
+}
+
+} // namespace
+
+Regions make_regions(const Dungeon& dd)
+{
+  Regions result
+    {
+      .data = std::vector<std::uint32_t>(dd.view.size(), Regions::NONE),
+      // Label 0 is never handed out
+      .sizes = {0},
+    };
+  result.view = RegionView(result.data.data(), dd.view.extents());
+
+  // Walls never start a flood, skip them a word at a time
+  for (int y = 0; y < dd.view.extent(0); ++y)
+    for (int x = 0; x < dd.view.extent(1); x += 64)
+      for (auto open = dd.walkable.row_mask(x, y); open != 0; open &= open - 1)
+      {
+        const int tx = x + std::countr_zero(open);
+        if (tx < dd.view.extent(1) && result.view(y, tx) == Regions::NONE)
+          flood(result, dd, {tx, y}, new_label(result));
+      }
+
+  return result;
+}
+
+std::uint32_t region_of(const Regions& regions, glm::ivec2 pos)
+{
+  return in_bounds(regions, pos) ? regions.view(pos.y, pos.x) : Regions::NONE;
+}
+
+bool reachable(const Regions& regions, glm::ivec2 from, glm::ivec2 to)
+{
+  const auto region = region_of(regions, from);
+  return region != Regions::NONE && region == region_of(regions, to);
+}
+
+std::uint32_t largest_region(const Regions& regions)
+{
+  return std::uint32_t(std::max_element(regions.sizes.begin(), regions.sizes.end()) - regions.sizes.begin());
+}
+
+void update_regions(Regions& regions, const Dungeon& dd, glm::ivec2 pos)
+{
+  if (!in_bounds(regions, pos))
+    return;
+
+  auto& label = regions.view(pos.y, pos.x);
+
+  if (!is_tile_walkable(dd, pos))
+  {
+    if (label == Regions::NONE)
+      return;
+    --regions.sizes[label];
+    label = Regions::NONE;
+    if (connected_around(dd, pos))
+      return;
+
+    // Neighbors might not be connected anymore. All of them but the first
+    // get flooded with a fresh label unless an earlier flood reached them,
+    // whatever is left with the old label is connected to the first one.
+    const auto firstNew = std::uint32_t(regions.sizes.size());
+    bool first = true;
+    for (auto delta : neighbors)
+    {
+      const auto next = pos + delta;
+      if (!dd.walkable.walkable(next))
+        continue;
+      if (!std::exchange(first, false) && region_of(regions, next) < firstNew)
+        flood(regions, dd, next, new_label(regions));
+    }
+    return;
+  }
+
+  if (label != Regions::NONE)
+    return;
+
+  // Join the largest neighboring region and pull the others into it
+  std::uint32_t largest = Regions::NONE;
+  for (auto delta : neighbors)
+    if (auto other = region_of(regions, pos + delta); other != Regions::NONE)
+      if (largest == Regions::NONE || regions.sizes[other] > regions.sizes[largest])
+        largest = other;
+
+  if (largest == Regions::NONE)
+  {
+    label = new_label(regions);
+    ++regions.sizes[label];
+    return;
+  }
+
+  flood(regions, dd, pos, largest);
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <experimental/mdspan>
+#include <glm/glm.hpp>
+
+#include "dungeon.hpp"
+
+
+namespace dungeon
+{
+
+using RegionView = std::experimental::mdspan<std::uint32_t, std::experimental::extents<int, std::dynamic_extent, std::dynamic_extent>>;
+
+// Lives on the dungeon entity. Labels every walkable tile with the
+// connected region it belongs to, so reachability is a comparison.
+// Computed at generation and updated incrementally by set_tile.
+struct Regions
+{
+  static constexpr std::uint32_t NONE = 0;
+
+  std::vector<std::uint32_t> data;
+  RegionView view;
+  // Set when the labels live in a mapped dungeon file instead of data
+  std::shared_ptr<MappedFile> file;
+  // Tile count of every label ever handed out, 0 for retired ones
+  std::vector<int> sizes;
+  // Scratch for flood fills
+  std::vector<glm::ivec2> stack;
+};
+
+Regions make_regions(const Dungeon& dd);
+
+// NONE for walls and out of bounds tiles
+std::uint32_t region_of(const Regions& regions, glm::ivec2 pos);
+bool reachable(const Regions& regions, glm::ivec2 from, glm::ivec2 to);
+std::uint32_t largest_region(const Regions& regions);
+
+// Has to be called after the tile at pos changed. Only the regions
+// around pos get relabeled: a new wall may split its region in parts,
+// a new floor tile may merge its neighbors' regions into the largest one.
+// A wall that leaves its neighbors connected right around it costs nothing,
+// otherwise every part but one gets flooded even when it turns out to be
+// the same region, so walling off a corridor of a big cave is O(cave).
+// Merges only flood the smaller regions.
+void update_regions(Regions& regions, const Dungeon& dd, glm::ivec2 pos);
+
+}
@@ -0,0 +1,235 @@
+#include "spatialIndex.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+namespace dungeon
+{
+
+SpatialIndex::SpatialIndex(DungeonView dungeon)
+  : cellsX_{(dungeon.extent(1) + CELL_SIZE - 1) / CELL_SIZE}
+  , cellsY_{(dungeon.extent(0) + CELL_SIZE - 1) / CELL_SIZE}
+{
+}
+
+glm::ivec2 SpatialIndex::cellOf(glm::ivec2 pos) const
+{
+  // Entities outside of the map go to the border cells,
+  // distances are always computed from actual positions anyways
+  return glm::clamp(pos / CELL_SIZE, glm::ivec2{0, 0}, glm::ivec2{cellsX_ - 1, cellsY_ - 1});
+}
+
+SpatialIndex::Bucket& SpatialIndex::bucket(int team, glm::ivec2 cell)
+{
+  auto grid = std::find_if(grids_.begin(), grids_.end(), [team](const TeamGrid& g) { return g.team == team; });
+  if (grid == grids_.end())
+    grid = grids_.insert(grids_.end(), TeamGrid{team, std::vector<Bucket>(cellsX_ * cellsY_)});
+  return grid->buckets[cell.y * cellsX_ + cell.x];
+}
+
+int SpatialIndex::maxRing(float radius) const
+{
+  const int whole = std::max(cellsX_, cellsY_);
+  if (!(radius < float(whole * CELL_SIZE)))
+    return whole;
+  return int(std::ceil(radius / CELL_SIZE));
+}
+
+void SpatialIndex::eraseFrom(Bucket& bucket, flecs::entity e)
+{
+  auto entry = std::find_if(bucket.begin(), bucket.end(), [e](const Entry& en) { return en.entity == e; });
+  std::swap(*entry, bucket.back());
+  bucket.pop_back();
+}
+
+template<class F>
+void SpatialIndex::forEachBucketInRing(glm::ivec2 cell, int ring, TeamSelector teams, F&& f) const
+{
+  auto visit = [&](int x, int y)
+    {
+      if (x < 0 || y < 0 || x >= cellsX_ || y >= cellsY_)
+        return;
+      for (auto& grid : grids_)
+        if (teams.matches(grid.team))
+          f(grid.buckets[y * cellsX_ + x]);
+    };
+
+  if (ring == 0)
+  {
+    visit(cell.x, cell.y);
+    return;
+  }
+
+  for (int x = cell.x - ring; x <= cell.x + ring; ++x)
+  {
+    visit(x, cell.y - ring);
+    visit(x, cell.y + ring);
+  }
+  for (int y = cell.y - ring + 1; y <= cell.y + ring - 1; ++y)
+  {
+    visit(cell.x - ring, y);
+    visit(cell.x + ring, y);
+  }
+}
+
+void SpatialIndex::update(flecs::entity e, glm::ivec2 pos)
+{
+  auto [it, inserted] = locations_.try_emplace(e.id(), Location{pos, TeamSelector::NO_TEAM});
+  auto& location = it->second;
+  if (!inserted)
+  {
+    const auto oldCell = cellOf(location.pos);
+    location.pos = pos;
+    if (oldCell == cellOf(pos))
+    {
+      for (auto& entry : bucket(location.team, oldCell))
+        if (entry.entity == e)
+          entry.pos = pos;
+      return;
+    }
+
+    eraseFrom(bucket(location.team, oldCell), e);
+  }
+
+  bucket(location.team, cellOf(pos)).push_back({e, pos});
+}
+
+void SpatialIndex::setTeam(flecs::entity e, int team)
+{
+  auto it = locations_.find(e.id());
+  if (it == locations_.end() || it->second.team == team)
+    return;
+
+  auto& location = it->second;
+  const auto cell = cellOf(location.pos);
+  eraseFrom(bucket(location.team, cell), e);
+  location.team = team;
+  bucket(location.team, cell).push_back({e, location.pos});
+}
+
+void SpatialIndex::erase(flecs::entity e)
+{
+  auto it = locations_.find(e.id());
+  if (it == locations_.end())
+    return;
+
+  eraseFrom(bucket(it->second.team, cellOf(it->second.pos)), e);
+  locations_.erase(it);
+}
+
+static float dist2(glm::ivec2 a, glm::ivec2 b)
+{
+  auto d = glm::vec2(a - b);
+  return glm::dot(d, d);
+}
+
+// No entity in ring `ring` can be closer than this
+static float ring_lower_bound(int ring)
+{
+  return float(std::max(0, ring - 1) * SpatialIndex::CELL_SIZE);
+}
+
+std::optional<SpatialIndex::Entry> SpatialIndex::closest(
+  glm::ivec2 center, float radius, TeamSelector teams, Filter filter, flecs::entity_t except) const
+{
+  if (grids_.empty())
+    return std::nullopt;
+
+  const float radius2 = radius * radius;
+  const auto centerCell = cellOf(center);
+
+  std::optional<Entry> best;
+  float bestDist2 = 0;
+  for (int ring = 0, last = maxRing(radius); ring <= last; ++ring)
+  {
+    const float bound = ring_lower_bound(ring);
+    if (bound * bound > radius2 || (best && bound * bound > bestDist2))
+      break;
+
+    forEachBucketInRing(centerCell, ring, teams,
+      [&](const Bucket& entries)
+      {
+        for (auto& entry : entries)
+        {
+          const float d2 = dist2(entry.pos, center);
+          if (d2 > radius2 || (best && d2 >= bestDist2) || entry.entity.id() == except || !filter(entry))
+            continue;
+          best = entry;
+          bestDist2 = d2;
+        }
+      });
+  }
+
+  return best;
+}
+
+std::size_t SpatialIndex::k_nearest(glm::ivec2 center, float radius, std::span<Entry> out,
+  TeamSelector teams, Filter filter, flecs::entity_t except) const
+{
+  if (grids_.empty() || out.empty())
+    return 0;
+
+  const float radius2 = radius * radius;
+  const auto centerCell = cellOf(center);
+
+  std::size_t found = 0;
+  auto worst2 = [&] { return dist2(out[found - 1].pos, center); };
+
+  for (int ring = 0, last = maxRing(radius); ring <= last; ++ring)
+  {
+    const float bound = ring_lower_bound(ring);
+    if (bound * bound > radius2 || (found == out.size() && bound * bound > worst2()))
+      break;
+
+    forEachBucketInRing(centerCell, ring, teams,
+      [&](const Bucket& entries)
+      {
+        for (auto& entry : entries)
+        {
+          const float d2 = dist2(entry.pos, center);
+          if (d2 > radius2 || (found == out.size() && d2 >= worst2())
+            || entry.entity.id() == except || !filter(entry))
+            continue;
+
+          // Insertion into a small sorted array
+          std::size_t i = found < out.size() ? found++ : found - 1;
+          while (i > 0 && dist2(out[i - 1].pos, center) > d2)
+          {
+            out[i] = out[i - 1];
+            --i;
+          }
+          out[i] = entry;
+        }
+      });
+  }
+
+  return found;
+}
+
+void SpatialIndex::for_each_in_radius(glm::ivec2 center, float radius, TeamSelector teams,
+  fu2::function_view<void(const Entry&) const> f) const
+{
+  if (grids_.empty())
+    return;
+
+  const float radius2 = radius * radius;
+  const auto centerCell = cellOf(center);
+  for (int ring = 0, last = maxRing(radius); ring <= last; ++ring)
+  {
+    const float bound = ring_lower_bound(ring);
+    if (bound * bound > radius2)
+      break;
+
+    forEachBucketInRing(centerCell, ring, teams,
+      [&](const Bucket& entries)
+      {
+        for (auto& entry : entries)
+          if (dist2(entry.pos, center) <= radius2)
+            f(entry);
+      });
+  }
+}
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <flecs.h>
+#include <glm/glm.hpp>
+#include <function2/function2.hpp>
+
+#include "dungeon.hpp"
+
+
+namespace dungeon
+{
+
+// Which teams a spatial query looks at
+struct TeamSelector
+{
+  static constexpr int NO_TEAM = -1;
+
+  enum class Mode { Any, Only, Except };
+
+  Mode mode{Mode::Any};
+  int team{NO_TEAM};
+
+  static TeamSelector any() { return {}; }
+  static TeamSelector only(int team) { return {Mode::Only, team}; }
+  // Entities without a team are never considered to be on another team
+  static TeamSelector except(int team) { return {Mode::Except, team}; }
+
+  bool matches(int other) const
+  {
+    switch (mode)
+    {
+      case Mode::Only: return other == team;
+      case Mode::Except: return other != team && other != NO_TEAM;
+      default: return true;
+    }
+  }
+};
+
+// Uniform grid of buckets over a dungeon, every bucket holds the
+// entities with a Position inside of it. There is a separate grid for
+// every team, so team queries never look at other teams' entities.
+// Lives on the dungeon entity and is updated incrementally by the
+// movement systems.
+class SpatialIndex
+{
+public:
+  static constexpr int CELL_SIZE = 8;
+
+  struct Entry
+  {
+    flecs::entity entity;
+    glm::ivec2 pos;
+  };
+
+  using Filter = fu2::function_view<bool(const Entry&) const>;
+
+  static bool accept_all(const Entry&) { return true; }
+
+  SpatialIndex() = default;
+  explicit SpatialIndex(DungeonView dungeon);
+
+  // Inserts the entity or moves it if it is already present
+  void update(flecs::entity e, glm::ivec2 pos);
+  // Moves an already indexed entity to another team's grid
+  void setTeam(flecs::entity e, int team);
+  void erase(flecs::entity e);
+
+  // Closest entity within the radius that passes the filter, ignoring `except`
+  std::optional<Entry> closest(glm::ivec2 center, float radius, TeamSelector teams,
+    Filter filter = accept_all, flecs::entity_t except = 0) const;
+
+  // Up to out.size() closest entities within the radius that pass the filter,
+  // sorted by distance. Returns how many were found.
+  std::size_t k_nearest(glm::ivec2 center, float radius, std::span<Entry> out, TeamSelector teams,
+    Filter filter = accept_all, flecs::entity_t except = 0) const;
+
+  // Calls f for every entry within the radius, in no particular order
+  void for_each_in_radius(glm::ivec2 center, float radius, TeamSelector teams,
+    fu2::function_view<void(const Entry&) const> f) const;
+
+private:
+  using Bucket = std::vector<Entry>;
+
+  struct TeamGrid
+  {
+    int team;
+    std::vector<Bucket> buckets;
+  };
+
+  struct Location
+  {
+    glm::ivec2 pos;
+    int team;
+  };
+
+  glm::ivec2 cellOf(glm::ivec2 pos) const;
+  Bucket& bucket(int team, glm::ivec2 cell);
+  int maxRing(float radius) const;
+
+  static void eraseFrom(Bucket& bucket, flecs::entity e);
+
+  // Visits the buckets of all selected teams that are exactly
+  // `ring` cells away (Chebyshev) from `cell`
+  template<class F>
+  void forEachBucketInRing(glm::ivec2 cell, int ring, TeamSelector teams, F&& f) const;
+
+private:
+  int cellsX_{0};
+  int cellsY_{0};
+  // There's only ever a handful of teams
+  std::vector<TeamGrid> grids_;
+  std::unordered_map<flecs::entity_t, Location> locations_;
+};
+
+}
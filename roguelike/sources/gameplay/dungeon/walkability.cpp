@@ -0,0 +1,55 @@
+#include "walkability.hpp"
+
+#include <bit>
+#include "dungeon.hpp"
+
+
+namespace dungeon
+{
+
+WalkabilityBits make_walkability(const Dungeon& dd)
+{
+  constexpr int P = WalkabilityBits::PADDING;
+
+  WalkabilityBits result
+    {
+      .width = dd.view.extent(1),
+      .height = dd.view.extent(0),
+      .wordsPerRow = (dd.view.extent(1) + 2 * P + 63) / 64,
+    };
+  result.words.resize(std::size_t(result.height + 2 * P) * result.wordsPerRow, 0);
+
+  for (int y = 0; y < result.height; ++y)
+  {
+    auto* row = result.words.data() + std::size_t(y + P) * result.wordsPerRow;
+    for (int x = 0; x < result.width; ++x)
+      if (dd.view(y, x) == Tile::Floor)
+        row[(x + P) / 64] |= std::uint64_t{1} << ((x + P) % 64);
+  }
+
+  return result;
+}
+
+int count_walkable(const WalkabilityBits& bits)
+{
+  // The padding is all walls, so whole rows can be counted
+  int result = 0;
+  for (auto word : bits.words)
+    result += std::popcount(word);
+  return result;
+}
+
+int count_walkable(const WalkabilityBits& bits, int y, int x0, int x1)
+{
+  int result = 0;
+  for (int x = x0; x < x1; x += 64)
+  {
+    auto mask = bits.row_mask(x, y);
+    if (x1 - x < 64)
+      mask &= (std::uint64_t{1} << (x1 - x)) - 1;
+    result += std::popcount(mask);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+
+namespace dungeon
+{
+
+struct Dungeon;
+
+// Walkability of the dungeon tiles packed into 64 bit words, one bit per
+// tile. Surrounded by a border of walls, so looking at the neighbors of
+// any tile never needs a bounds check.
+struct WalkabilityBits
+{
+  static constexpr int PADDING = 1;
+
+  int width{0};
+  int height{0};
+  int wordsPerRow{0};
+  // height + 2 * PADDING rows, bit x + PADDING of a row is tile x
+  std::vector<std::uint64_t> words;
+
+  const std::uint64_t* row(int y) const
+  {
+    return words.data() + std::size_t(y + PADDING) * wordsPerRow;
+  }
+
+  std::uint64_t* row(int y)
+  {
+    return words.data() + std::size_t(y + PADDING) * wordsPerRow;
+  }
+
+  // Tiles of the map and its padding only
+  bool walkable(glm::ivec2 pos) const
+  {
+    const int x = pos.x + PADDING;
+    return (row(pos.y)[x / 64] >> (x % 64)) & 1;
+  }
+
+  // Any position, everything outside of the map is a wall
+  bool walkable_anywhere(glm::ivec2 pos) const
+  {
+    return pos.x >= 0 && pos.y >= 0 && pos.x < width && pos.y < height && walkable(pos);
+  }
+
+  void set(glm::ivec2 pos, bool walkable)
+  {
+    const int x = pos.x + PADDING;
+    const auto bit = std::uint64_t{1} << (x % 64);
+    auto& word = row(pos.y)[x / 64];
+    word = walkable ? word | bit : word & ~bit;
+  }
+
+  // The 64 tiles of row y starting at x, bit i is tile x + i.
+  // Like walkable, x can go as far as the padding.
+  std::uint64_t row_mask(int x, int y) const
+  {
+    const int bit = x + PADDING;
+    const int w = bit / 64;
+    const int shift = bit % 64;
+    const auto* r = row(y);
+    const std::uint64_t hi = shift != 0 && w + 1 < wordsPerRow ? r[w + 1] << (64 - shift) : 0;
+    return r[w] >> shift | hi;
+  }
+
+  // Bits 0 to 3 are the tiles to the right, left, below and above pos
+  unsigned neighbor_mask(glm::ivec2 pos) const
+  {
+    const int x = pos.x + PADDING;
+    auto at = [x](const std::uint64_t* r, int dx) { return unsigned(r[(x + dx) / 64] >> ((x + dx) % 64)) & 1; };
+    const auto* mid = row(pos.y);
+    return at(mid, 1) | at(mid, -1) << 1 | at(row(pos.y + 1), 0) << 2 | at(row(pos.y - 1), 0) << 3;
+  }
+};
+
+WalkabilityBits make_walkability(const Dungeon& dd);
+
+// Popcounts over whole words, x1 is exclusive
+int count_walkable(const WalkabilityBits& bits);
+int count_walkable(const WalkabilityBits& bits, int y, int x0, int x1);
+
+}
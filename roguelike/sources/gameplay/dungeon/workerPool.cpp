@@ -0,0 +1,80 @@
+#include "workerPool.hpp"
+
+#include <algorithm>
+
+
+namespace dungeon
+{
+
+WorkerPool::WorkerPool(std::size_t threads)
+{
+  threads_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    threads_.emplace_back([this, worker = i + 1]() { work(worker); });
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  started_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+std::size_t WorkerPool::default_threads()
+{
+  return std::max(std::thread::hardware_concurrency(), 1u) - 1;
+}
+
+void WorkerPool::dispatch(Call call, void* context)
+{
+  {
+    std::unique_lock lock(mutex_);
+    if (busy_)
+    {
+      lock.unlock();
+      for (std::size_t worker = 0; worker < size(); ++worker)
+        call(context, worker);
+      return;
+    }
+    busy_ = true;
+    call_ = call;
+    context_ = context;
+    running_ = threads_.size();
+    ++generation_;
+  }
+  started_.notify_all();
+
+  call(context, 0);
+
+  std::unique_lock lock(mutex_);
+  finished_.wait(lock, [this]() { return running_ == 0; });
+  busy_ = false;
+}
+
+void WorkerPool::work(std::size_t worker)
+{
+  std::uint64_t seen = 0;
+  std::unique_lock lock(mutex_);
+  for (;;)
+  {
+    started_.wait(lock, [&]() { return stopping_ || generation_ != seen; });
+    if (stopping_)
+      return;
+    seen = generation_;
+    const Call call = call_;
+    void* const context = context_;
+
+    lock.unlock();
+    call(context, worker);
+    lock.lock();
+
+    if (--running_ == 0)
+      finished_.notify_one();
+  }
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+#include <condition_variable>
+
+
+namespace dungeon
+{
+
+// Threads that stick around between jobs, so that per turn work doesn't
+// pay for creating and joining threads. The calling thread always takes
+// part as worker 0. One job at a time: whoever calls run while another
+// job is going runs all the workers' shares of its own job by itself.
+class WorkerPool
+{
+public:
+  // Threads besides the calling one
+  explicit WorkerPool(std::size_t threads = default_threads());
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  static std::size_t default_threads();
+
+  // Workers a job gets run on, the caller included
+  std::size_t size() const { return threads_.size() + 1; }
+
+  // Calls job(worker) once for every worker, returns when all of them are done
+  template<class Job>
+  void run(Job&& job)
+  {
+    dispatch(
+      [](void* context, std::size_t worker)
+      {
+        (*static_cast<std::remove_reference_t<Job>*>(context))(worker);
+      },
+      &job);
+  }
+
+private:
+  using Call = void(*)(void*, std::size_t);
+
+  void dispatch(Call call, void* context);
+  void work(std::size_t worker);
+
+private:
+  std::mutex mutex_;
+  std::condition_variable started_;
+  std::condition_variable finished_;
+  Call call_{nullptr};
+  void* context_{nullptr};
+  std::uint64_t generation_{0};
+  std::size_t running_{0};
+  bool busy_{false};
+  bool stopping_{false};
+  std::vector<std::thread> threads_;
+};
+
+// World singleton, the one pool all levels share
+struct Workers
+{
+  std::shared_ptr<WorkerPool> pool;
+};
+
+}
@@ -3,12 +3,44 @@
 #include "actions.hpp"
 #include "gameplay/dungeon/dmaps.hpp"
 #include "gameplay/dungeon/dungeon.hpp"
+#include "gameplay/dungeon/dungeonUtils.hpp"
+#include "gameplay/dungeon/spatialIndex.hpp"
+#include "gameplay/dungeon/moveReservations.hpp"
+#include "gameplay/dungeon/pathfinding.hpp"
+#include "gameplay/dungeon/pathQueue.hpp"
+#include "gameplay/dungeon/regions.hpp"
+#include "gameplay/dungeon/levelPool.hpp"
+#include "levels.hpp"
 #include <spdlog/fmt/fmt.h>
+#include <limits>
+#include <yaml-cpp/yaml.h>
+#include <assert.hpp>
 
 
+flecs::entity create_dungeon(flecs::world& world, std::string_view name, dungeon::Dungeon dungeon)
+{
+  return create_dungeon(world, name, dungeon::prepare_level(std::move(dungeon), world.get<dungeon::Workers>()->pool.get()));
+}
+
+flecs::entity create_dungeon(flecs::world& world, std::string_view name, dungeon::PreparedLevel level)
+{
+  auto result = world.entity(std::string(name).c_str());
+  attach_level(result, std::move(level));
+  result.set(dungeon::Pickups{});
+  world.set(dungeon::CurrentDungeon{result});
+  return result;
+}
+
+// Everything spawns on the current dungeon and stays there unless it travels
+static flecs::entity spawn(flecs::world& world, const char* name = nullptr)
+{
+  return world.entity(name)
+    .add<dungeon::OnLevel>(world.get<dungeon::CurrentDungeon>()->entity);
+}
+
 flecs::entity create_monster(flecs::world& world, glm::ivec2 pos)
 {
-  return world.entity()
+  return spawn(world)
     .set(Position{pos})
     .set(MovePos{pos})
     .set(PatrolPos{4, pos})
@@ -25,7 +57,7 @@ flecs::entity create_monster(flecs::world& world, glm::ivec2 pos)
 
 flecs::entity create_player(flecs::world& world, glm::ivec2 pos)
 {
-  return world.entity("player")
+  return spawn(world, "player")
     .set(Position{pos})
     .set(MovePos{pos})
     .set(Hitpoints{100.f})
@@ -39,7 +71,7 @@ flecs::entity create_player(flecs::world& world, glm::ivec2 pos)
 
 flecs::entity create_friend(flecs::world& world, glm::ivec2 pos)
 {
-  return world.entity()
+  return spawn(world)
     .set(Position{pos})
     .set(MovePos{pos})
     .set(Hitpoints{100.f})
@@ -56,30 +88,32 @@ flecs::entity create_friend(flecs::world& world, glm::ivec2 pos)
 
 void create_heal(flecs::world& world, glm::ivec2 pos, float amount)
 {
-  world.entity()
+  auto item = spawn(world)
     .set(Position{pos})
     .set(HealAmount{amount})
     .set(Color{0xff4444ff});
+  dungeon::add_pickup(*dungeon::dungeon_of(item).get_mut<dungeon::Pickups>(), pos, item);
 }
 
 void create_powerup(flecs::world& world, glm::ivec2 pos, float amount)
 {
-  world.entity()
+  auto item = spawn(world)
     .set(Position{pos})
     .set(PowerupAmount{amount})
     .set(Color{0xff00ffff});
+  dungeon::add_pickup(*dungeon::dungeon_of(item).get_mut<dungeon::Pickups>(), pos, item);
 }
 
 flecs::entity create_patrool_route(flecs::world& world, std::string_view name,
   SpriteId sprite, std::span<const glm::ivec2> coords)
 {
-  auto first = world.entity(fmt::format("{}_{}", name, 0).c_str())
+  auto first = spawn(world, fmt::format("{}_{}", name, 0).c_str())
     .set(Sprite{sprite})
     .set(Position{coords.front()});
   flecs::entity prev = first;
   for (std::size_t i = 1; i < coords.size(); ++i)
   {
-    auto wp = world.entity(fmt::format("{}_{}", name, i).c_str())
+    auto wp = spawn(world, fmt::format("{}_{}", name, i).c_str())
       .set(Sprite{sprite})
       .set(Position{coords[i]});
     std::exchange(prev, wp).add<Waypoint>(wp);
@@ -94,9 +128,46 @@ flecs::entity create_dmap(flecs::world& world,
   flecs::query<const Position> starting_points,
   fu2::function<dungeon::dmaps::PotentialFuncSig> potential)
 {
-  return world.entity(std::string(name).c_str())
-    .set(std::move(starting_points))
+  // Named after parenting, every level has dmaps with the same names
+  return world.entity()
     .add(flecs::ChildOf, dungeon)
+    .set_name(std::string(name).c_str())
+    .set(std::move(starting_points))
     .set(dungeon::dmaps::PotentialHolder{std::move(potential)})
+    .set(dungeon::dmaps::DmapUsers{})
     .set(dungeon::dmaps::make(dungeon.get<dungeon::Dungeon>()->view));
 }
+
+static flecs::query<const Position> dmap_sources(flecs::world& world, const std::string& sources)
+{
+  if (sources == "player")
+    return world.query_builder<const Position>().term<IsPlayer>().build();
+  if (sources == "heal")
+    return world.query_builder<const Position>().term<HealAmount>().build();
+  if (sources == "powerup")
+    return world.query_builder<const Position>().term<PowerupAmount>().build();
+
+  NG_PANIC("Unknown dmap sources '{}'!", sources);
+}
+
+void load_dmaps(flecs::world& world, flecs::entity dungeon, std::filesystem::path path)
+{
+  const auto root = YAML::LoadFile(path.string());
+  NG_ASSERT(root.IsMap());
+  for (auto it = root.begin(); it != root.end(); ++it)
+  {
+    auto name = it->first.as<std::string>();
+    auto& desc = it->second;
+
+    const float weight = desc["weight"].as<float>(1.f);
+    const float cutoff = desc["cutoff"].as<float>(std::numeric_limits<float>::infinity());
+
+    create_dmap(world, name, dungeon,
+      dmap_sources(world, desc["sources"].as<std::string>()),
+      [weight, cutoff](float d)
+      {
+        // Beyond the cutoff the potential becomes flat
+        return d > cutoff ? 0.f : weight;
+      });
+  }
+}
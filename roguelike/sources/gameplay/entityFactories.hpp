@@ -1,6 +1,7 @@
 #pragma once
 
 #include <span>
+#include <filesystem>
 #include <string_view>
 #include <flecs.h>
 #include <glm/glm.hpp>
@@ -8,9 +9,19 @@
 
 #include <sprite.hpp>
 #include "components.hpp"
+#include "dungeon/dungeon.hpp"
 #include "dungeon/dmaps.hpp"
 
+namespace dungeon
+{
+struct PreparedLevel;
+}
 
+
+// Makes the dungeon current and attaches all the per-tile bookkeeping to it
+flecs::entity create_dungeon(flecs::world& world, std::string_view name, dungeon::Dungeon dungeon);
+// Same, for a level that a LevelPool already prepared
+flecs::entity create_dungeon(flecs::world& world, std::string_view name, dungeon::PreparedLevel level);
 flecs::entity create_monster(flecs::world& world, glm::ivec2 pos);
 flecs::entity create_player(flecs::world& world,  glm::ivec2 pos);
 flecs::entity create_friend(flecs::world& world, glm::ivec2 pos);
@@ -25,3 +36,7 @@ flecs::entity create_dmap(flecs::world& world,
   flecs::entity dungeon,
   flecs::query<const Position> starting_points,
   fu2::function<dungeon::dmaps::PotentialFuncSig> potential);
+
+// Creates every dmap declared in a yaml file as a child of the dungeon.
+// Declared dmaps stay dormant until something acquires them.
+void load_dmaps(flecs::world& world, flecs::entity dungeon, std::filesystem::path path);
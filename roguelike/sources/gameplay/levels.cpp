@@ -0,0 +1,181 @@
+#include "levels.hpp"
+#include "components.hpp"
+#include "gameplay/dungeon/dungeon.hpp"
+#include "gameplay/dungeon/dungeonUtils.hpp"
+#include "gameplay/dungeon/levelPool.hpp"
+#include "gameplay/dungeon/spatialIndex.hpp"
+#include "gameplay/dungeon/moveReservations.hpp"
+#include "gameplay/dungeon/pathfinding.hpp"
+#include "gameplay/dungeon/pathQueue.hpp"
+#include "gameplay/dungeon/fov.hpp"
+#include <cstdlib>
+#include <vector>
+#include <assert.hpp>
+
+
+void attach_level(flecs::entity level, dungeon::PreparedLevel prepared)
+{
+  auto reservations = dungeon::make_move_reservations(prepared.dungeon);
+  dungeon::SpatialIndex index(prepared.dungeon.view);
+  dungeon::PathService paths(prepared.dungeon.view);
+  level
+    .set(std::move(prepared.dungeon))
+    .set(std::move(prepared.walkable))
+    .set(std::move(prepared.occupancy))
+    .set(std::move(reservations))
+    .set(std::move(index))
+    .set(std::move(paths))
+    .set(dungeon::PathQueue{})
+    .set(std::move(prepared.clusters))
+    .set(std::move(prepared.regions));
+}
+
+// Everything bound to the level and its dmaps, disabled or not
+static std::vector<flecs::entity> level_entities(flecs::entity level)
+{
+  std::vector<flecs::entity> result;
+  level.world().filter_builder()
+    .term<dungeon::OnLevel>(level)
+    .term(flecs::Disabled).optional()
+    .build()
+    .each([&](flecs::entity e) { result.push_back(e); });
+  level.children([&](flecs::entity child) { result.push_back(child); });
+  return result;
+}
+
+static void suspend(flecs::entity level)
+{
+  if (level.has<Suspended>())
+    return;
+  for (auto e : level_entities(level))
+    e.disable();
+  level.add<Suspended>().disable();
+}
+
+static void evict(flecs::entity level)
+{
+  suspend(level);
+  if (level.has<Evicted>())
+    return;
+
+  // Everything here gets built again from the tiles
+  level
+    .remove<dungeon::WalkableTiles>()
+    .remove<dungeon::Occupancy>()
+    .remove<dungeon::MoveReservations>()
+    .remove<dungeon::SpatialIndex>()
+    .remove<dungeon::PathService>()
+    .remove<dungeon::PathQueue>()
+    .remove<dungeon::ClusterGraph>()
+    .remove<dungeon::Regions>()
+    .add<Evicted>();
+
+  // Tiles nobody touched are the same as the generated ones
+  if (level.has<Level>() && level.get<dungeon::Dungeon>()->revision == 0)
+    level.remove<dungeon::Dungeon>();
+}
+
+static void activate(flecs::entity level, dungeon::LevelPool& pool)
+{
+  const bool reload = level.has<Evicted>();
+  if (reload)
+  {
+    attach_level(level, level.has<dungeon::Dungeon>()
+      ? dungeon::prepare_level(std::move(*level.get_mut<dungeon::Dungeon>()),
+          level.world().get<dungeon::Workers>()->pool.get())
+      : pool.take(level.get<Level>()->params));
+    level.remove<Evicted>();
+  }
+
+  if (!level.has<Suspended>())
+    return;
+
+  const auto entities = level_entities(level);
+  level.remove<Suspended>().enable();
+  for (auto e : entities)
+    e.enable();
+
+  if (!reload)
+    return;
+
+  // Enabling doesn't trigger the observers, fresh bookkeeping is filled in by hand
+  auto& occupancy = *level.get_mut<dungeon::Occupancy>();
+  auto& index = *level.get_mut<dungeon::SpatialIndex>();
+  for (auto e : entities)
+  {
+    if (auto mpos = e.get<MovePos>())
+      dungeon::occupy(occupancy, mpos->v, e);
+    if (auto pos = e.get<Position>())
+    {
+      index.update(e, pos->v);
+      if (auto team = e.get<Team>())
+        index.setTeam(e, team->team);
+    }
+  }
+}
+
+void enter_level(flecs::world& world, flecs::entity level, dungeon::LevelPool& pool)
+{
+  activate(level, pool);
+  world.set(dungeon::CurrentDungeon{level});
+
+  const int depth = level.has<Level>() ? level.get<Level>()->depth : 0;
+  // Copies, evicting moves the components around
+  std::vector<std::pair<flecs::entity, Level>> others;
+  world.filter_builder<const Level>()
+    .term(flecs::Disabled).optional()
+    .build()
+    .each(
+      [&](flecs::entity other, const Level& lvl)
+      {
+        if (other != level)
+          others.push_back({other, lvl});
+      });
+
+  for (const auto& [other, lvl] : others)
+  {
+    if (std::abs(lvl.depth - depth) > KEEP_LOADED_DISTANCE)
+    {
+      evict(other);
+      continue;
+    }
+
+    suspend(other);
+    // Getting there shouldn't wait on generation
+    if (other.has<Evicted>() && !other.has<dungeon::Dungeon>())
+      pool.prefetch(lvl.params);
+  }
+}
+
+void travel(flecs::entity e, flecs::entity level, glm::ivec2 pos)
+{
+  NG_ASSERT(!level.has<Evicted>());
+
+  // Either level might be suspended and disabled entities don't trigger
+  // the observers, so the bookkeeping is updated by hand on both sides
+  if (auto from = dungeon::dungeon_of(e); from && !from.has<Evicted>())
+  {
+    if (auto mpos = e.get<MovePos>())
+      dungeon::vacate(*from.get_mut<dungeon::Occupancy>(), mpos->v, e);
+    from.get_mut<dungeon::SpatialIndex>()->erase(e);
+  }
+
+  e.add<dungeon::OnLevel>(level);
+  // Observers skip disabled entities, smart movement has to go over to
+  // the dmaps of the new level before the entity might get disabled
+  e.enable();
+  if (e.has<SmartMovement>())
+    e.modified<SmartMovement>();
+  if (level.has<Suspended>())
+    e.disable();
+  e.set(Position{pos}).set(MovePos{pos});
+  // Whatever it saw was on the old level
+  if (e.has<dungeon::FieldOfView>())
+    e.get_mut<dungeon::FieldOfView>()->radius = -1;
+
+  dungeon::occupy(*level.get_mut<dungeon::Occupancy>(), pos, e);
+  auto& index = *level.get_mut<dungeon::SpatialIndex>();
+  index.update(e, pos);
+  if (auto team = e.get<Team>())
+    index.setTeam(e, team->team);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <flecs.h>
+#include <glm/glm.hpp>
+
+#include "dungeon/dungeonGenerator.hpp"
+
+namespace dungeon
+{
+class LevelPool;
+struct PreparedLevel;
+}
+
+
+// Lives on dungeon entities that can be generated again from their params
+struct Level
+{
+  int depth;
+  dungeon::GeneratorParams params;
+};
+
+// Tags on dungeon entities that aren't simulated. Suspended levels and
+// everything on them are disabled but stay in memory. Evicted levels also
+// drop all the per-tile bookkeeping, and their tiles too if they can be
+// generated again.
+struct Suspended {};
+struct Evicted {};
+
+// Floors this close to the current one are only suspended
+constexpr int KEEP_LOADED_DISTANCE = 1;
+
+// Everything create_dungeon attaches to a dungeon entity, but the pickups
+void attach_level(flecs::entity level, dungeon::PreparedLevel prepared);
+
+// Makes the level current, loading it back if it was evicted. The other
+// levels get suspended or evicted depending on how far they are from it,
+// the floors next to it get prefetched.
+void enter_level(flecs::world& world, flecs::entity level, dungeon::LevelPool& pool);
+
+// Moves an entity to a loaded level, frees its tile on the old one and
+// recompiles its smart movement against the dmaps of the new one
+void travel(flecs::entity e, flecs::entity level, glm::ivec2 pos);
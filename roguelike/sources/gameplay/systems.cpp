@@ -7,6 +7,11 @@
 #include "gameplay/dungeon/dungeon.hpp"
 #include "gameplay/dungeon/dungeonUtils.hpp"
 #include "gameplay/dungeon/dmaps.hpp"
+#include "gameplay/dungeon/spatialIndex.hpp"
+#include "gameplay/dungeon/fov.hpp"
+#include "gameplay/dungeon/moveReservations.hpp"
+#include "gameplay/dungeon/pathQueue.hpp"
+#include "gameplay/dungeon/workerPool.hpp"
 
 
 struct PerformTurn {};
@@ -15,6 +20,7 @@ flecs::entity register_systems(flecs::world& world)
 {
   world.component<ClosestVisibleAlly>().add(flecs::Union);
   world.component<ClosestVisibleEnemy>().add(flecs::Union);
+  world.component<dungeon::OnLevel>().add(flecs::Exclusive);
   world.component<glm::ivec2>()
     .member<int>("x")
     .member<int>("y");
@@ -40,51 +46,169 @@ flecs::entity register_systems(flecs::world& world)
   world.component<Sprite>()
     .member<std::size_t>("id");
 
-  world.system<Action, Position, MovePos, const MeleeDamage, const Team>("calculate movement")
+  world.observer<const MovePos>("occupy spawn tile")
+    .event(flecs::OnSet)
+    .each(
+      [](flecs::entity entity, const MovePos& mpos)
+      {
+        if (auto level = dungeon::dungeon_of(entity))
+          dungeon::occupy(*level.get_mut<dungeon::Occupancy>(), mpos.v, entity);
+      });
+
+  // Also fires when the entity dies
+  world.observer<const MovePos>("vacate tile")
+    .event(flecs::OnRemove)
+    .each(
+      [](flecs::entity entity, const MovePos& mpos)
+      {
+        if (auto level = dungeon::dungeon_of(entity); level.is_alive())
+          dungeon::vacate(*level.get_mut<dungeon::Occupancy>(), mpos.v, entity);
+      });
+
+  world.set(dungeon::Workers{std::make_shared<dungeon::WorkerPool>()});
+
+  world.system<dungeon::MoveReservations, dungeon::Occupancy, const dungeon::Dungeon>("calculate movement")
     .kind<PerformTurn>()
     .each(
-      [ checkAttacks = world.query<const MovePos, Hitpoints, const Team>()
-      , checkDungeon = world.query<const dungeon::Dungeon>()
-      ]
-      (flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+      [movers = world.query_builder<Action, MovePos, const MeleeDamage, const Team>()
+        .group_by(world.component<dungeon::OnLevel>())
+        .build()]
+      (flecs::entity level, dungeon::MoveReservations& reservations, dungeon::Occupancy& occupancy,
+        const dungeon::Dungeon& dd)
       {
-        Position nextPos{move(pos.v, a.action)};
-        if (nextPos.v == pos.v)
+        struct Mover
         {
-          mpos.v = nextPos.v;
-          return;
-        }
+          flecs::entity entity;
+          Action* action;
+          MovePos* mpos;
+          float damage;
+          int team;
+        };
+
+        // Reused between turns
+        static std::vector<Mover> agents;
+        static std::vector<dungeon::MoveRequest> requests;
+        static std::vector<dungeon::MoveResult> results;
+        agents.clear();
+        requests.clear();
+
+        // Intents, nothing gets mutated until everything is resolved.
+        // Movers are grouped by level, only the tables of this one are visited.
+        auto gather = [&](flecs::iter& it, Action* a, MovePos* mpos, const MeleeDamage* dmg, const Team* team)
+          {
+            for (auto i : it)
+            {
+              auto entity = it.entity(i);
+              agents.push_back({entity, &a[i], &mpos[i], dmg[i].damage, team[i].team});
+              requests.push_back({entity.id(), mpos[i].v, move(mpos[i].v, a[i].action)});
+            }
+          };
+        movers.iter().set_group(level).iter(gather);
+        // Movers without OnLevel are in group 0, like dungeon_of they go on the current level
+        if (level == level.world().get<dungeon::CurrentDungeon>()->entity)
+          movers.iter().set_group(0).iter(gather);
+
+        // Resolving is split across workers, applying stays on this thread
+        // since it goes through the free tile set, the path queue and
+        // whoever got bumped, all of them shared between agents
+        results.resize(requests.size());
+        dungeon::resolve_moves(reservations, dd, occupancy, requests, results,
+          *level.world().get<dungeon::Workers>()->pool);
+        auto pathQueue = level.get_mut<dungeon::PathQueue>();
 
-        bool blocked = false;
-        checkAttacks.each([&](flecs::entity enemy, const MovePos &epos, Hitpoints &hp, const Team &enemy_team)
+        for (std::size_t i = 0; i < agents.size(); ++i)
         {
-          if (entity != enemy && epos.v == nextPos.v)
+          auto& agent = agents[i];
+          const auto& req = requests[i];
+          const auto& res = results[i];
+
+          if (res.moved)
           {
-            blocked = true;
-            if (team.team != enemy_team.team)
-              hp.hitpoints -= dmg.damage;
-            if (auto acts = entity.get_mut<NumActions>())
-              acts->curActions++;
+            dungeon::vacate(occupancy, req.from, agent.entity);
+            agent.mpos->v = req.to;
+            dungeon::occupy(occupancy, req.to, agent.entity);
+            if (pathQueue)
+              pathQueue->moved(agent.entity, req.to);
+            continue;
           }
-        });
 
-        checkDungeon.each([&](const dungeon::Dungeon& d)
-          {
-            if (!dungeon::is_tile_walkable(d, nextPos.v))
-              blocked = true;
-          });
+          if (req.to != req.from)
+            agent.action->action = ActionType::NOP;
 
-        if (blocked)
-          a.action = ActionType::NOP;
-        else
-          mpos.v = nextPos.v;
+          if (res.bumped == 0)
+            continue;
+
+          auto enemy = level.world().entity(res.bumped);
+          auto enemyTeam = enemy.get<Team>();
+          auto hp = enemy.get_mut<Hitpoints>();
+          if (hp && enemyTeam && agent.team != enemyTeam->team)
+            hp->hitpoints -= agent.damage;
+          if (auto acts = agent.entity.get_mut<NumActions>())
+            acts->curActions++;
+        }
+      });
+
+  world.system<dungeon::PathQueue, dungeon::PathService, dungeon::ClusterGraph, const dungeon::Dungeon>("serve path requests")
+    .kind<PerformTurn>()
+    .each(
+      [](flecs::entity level, dungeon::PathQueue& queue, dungeon::PathService& paths, dungeon::ClusterGraph& clusters,
+        const dungeon::Dungeon& dd)
+      {
+        queue.serve(dd, paths, &clusters, *level.world().get<dungeon::Workers>()->pool);
+      });
+
+  world.observer<const Position>("index spawn position")
+    .event(flecs::OnSet)
+    .each(
+      [](flecs::entity entity, const Position& pos)
+      {
+        if (auto level = dungeon::dungeon_of(entity))
+        {
+          auto index = level.get_mut<dungeon::SpatialIndex>();
+          index->update(entity, pos.v);
+          // Team might have been set before the position
+          if (auto team = entity.get<Team>())
+            index->setTeam(entity, team->team);
+        }
+      });
+
+  // Also fires when the entity dies
+  world.observer<const Position>("unindex position")
+    .event(flecs::OnRemove)
+    .each(
+      [](flecs::entity entity, const Position&)
+      {
+        if (auto level = dungeon::dungeon_of(entity); level.is_alive())
+          level.get_mut<dungeon::SpatialIndex>()->erase(entity);
+      });
+
+  world.observer<const Team>("index team")
+    .event(flecs::OnSet)
+    .each(
+      [](flecs::entity entity, const Team& team)
+      {
+        if (auto level = dungeon::dungeon_of(entity))
+          level.get_mut<dungeon::SpatialIndex>()->setTeam(entity, team.team);
+      });
+
+  world.observer<const Team>("unindex team")
+    .event(flecs::OnRemove)
+    .each(
+      [](flecs::entity entity, const Team&)
+      {
+        if (auto level = dungeon::dungeon_of(entity); level.is_alive())
+          level.get_mut<dungeon::SpatialIndex>()->setTeam(entity, dungeon::TeamSelector::NO_TEAM);
       });
 
   world.system<Position, const MovePos>("perform movement")
     .kind<PerformTurn>()
-    .each([&](Position &pos, const MovePos &mpos)
+    .each([&](flecs::entity entity, Position &pos, const MovePos &mpos)
     {
+      if (pos.v == mpos.v)
+        return;
+
       pos.v = mpos.v;
+      dungeon::dungeon_of(entity).get_mut<dungeon::SpatialIndex>()->update(entity, pos.v);
     });
 
   world.system<const Action, Hitpoints, const HitpointsRegen>("perform regen")
@@ -128,73 +252,91 @@ flecs::entity register_systems(flecs::world& world)
           entity.destruct();
       });
 
-  world.system<const Position, Hitpoints, MeleeDamage>()
+  // Also fire when pickups get picked up
+  world.observer<const Position, const HealAmount>("unindex heal")
+    .event(flecs::OnRemove)
+    .each(
+      [](flecs::entity item, const Position& pos, const HealAmount&)
+      {
+        if (auto level = dungeon::dungeon_of(item); level.is_alive())
+          dungeon::remove_pickup(*level.get_mut<dungeon::Pickups>(), pos.v, item);
+      });
+
+  world.observer<const Position, const PowerupAmount>("unindex powerup")
+    .event(flecs::OnRemove)
+    .each(
+      [](flecs::entity item, const Position& pos, const PowerupAmount&)
+      {
+        if (auto level = dungeon::dungeon_of(item); level.is_alive())
+          dungeon::remove_pickup(*level.get_mut<dungeon::Pickups>(), pos.v, item);
+      });
+
+  world.system<const Position, Hitpoints, MeleeDamage>("pick up items")
     .kind<PerformTurn>()
     .each(
-      [healPickup = world.query<const Position, const HealAmount>(),
-        powerupPickup = world.query<const Position, const PowerupAmount>()]
-      (const Position& pos, Hitpoints& hp, MeleeDamage& dmg)
+      [](flecs::entity entity, const Position& pos, Hitpoints& hp, MeleeDamage& dmg)
       {
-        healPickup.each([&](flecs::entity entity, const Position &ppos, const HealAmount &amt)
-        {
-          if (pos.v == ppos.v)
-          {
-            hp.hitpoints += amt.amount;
-            entity.destruct();
-          }
-        });
-        powerupPickup.each([&](flecs::entity entity, const Position &ppos, const PowerupAmount &amt)
+        auto& pickups = *dungeon::dungeon_of(entity).get<dungeon::Pickups>();
+        auto [b, e] = pickups.items.equal_range(dungeon::Pickups::tileKey(pos.v));
+        // Destruction is deferred, the index gets updated by the observers later
+        for (; b != e; ++b)
         {
-          if (pos.v == ppos.v)
-          {
-            dmg.damage += amt.amount;
-            entity.destruct();
-          }
-        });
+          auto item = b->second;
+          if (auto amt = item.get<HealAmount>())
+            hp.hitpoints += amt->amount;
+          if (auto amt = item.get<PowerupAmount>())
+            dmg.damage += amt->amount;
+          item.destruct();
+        }
       });
 
 
-  world.system<const Position, const Visibility, const Team>()
+  world.observer<const Visibility>("add field of view")
+    .event(flecs::OnSet)
+    .each(
+      [](flecs::entity e, const Visibility&)
+      {
+        e.add<dungeon::FieldOfView>();
+      });
+
+  world.system<const Position, const Visibility, dungeon::FieldOfView>("update field of view")
+    .kind<PerformTurn>()
+    .each(
+      [](flecs::entity e, const Position& pos, const Visibility& vis, dungeon::FieldOfView& fov)
+      {
+        auto& dd = *dungeon::dungeon_of(e).get<dungeon::Dungeon>();
+        const int radius = int(vis.visibility);
+        if (!fov.isUpToDate(pos.v, radius, dd.revision))
+          dungeon::compute_fov(dd, pos.v, radius, fov);
+      });
+
+  world.system<const Position, const Visibility, const Team, const dungeon::FieldOfView>()
     .kind<PerformTurn>()
     .term<ClosestVisibleEnemy>(flecs::Wildcard).or_()
     .term<ClosestVisibleAlly>(flecs::Wildcard).or_()
     .each(
-      [qother = world.query_builder<const Position, const Team>().build()]
-      (flecs::entity e, const Position& pos1, Visibility vis, const Team& team1)
+      [](flecs::entity e, const Position& pos1, Visibility vis, const Team& team1, const dungeon::FieldOfView& fov)
       {
         bool needsClosestEnemy = e.has<ClosestVisibleEnemy>(flecs::Wildcard);
         bool needsClosestAlly = e.has<ClosestVisibleAlly>(flecs::Wildcard);
 
-        float closestEnemyDist = 0;
-        float closestAllyDist = 0;
         const auto noEntity = e.world().component<NoVisibleEntity>();
         flecs::entity closestEnemy = noEntity;
         flecs::entity closestAlly = noEntity;
 
-        qother.each(
-          [&](flecs::entity e2, const Position& pos2, const Team& team2)
-          {
-            if (e == e2)
-              return;
+        auto& index = *dungeon::dungeon_of(e).get<dungeon::SpatialIndex>();
 
-            auto dist = glm::length(glm::vec2(pos2.v - pos1.v));
-            if (dist > vis.visibility)
-              return;
+        auto isVisible = [&fov](const dungeon::SpatialIndex::Entry& other) { return fov.visible(other.pos); };
 
-            if (needsClosestEnemy && team1.team != team2.team
-              && (closestEnemy == noEntity || dist < closestEnemyDist))
-            {
-              closestEnemyDist = dist;
-              closestEnemy = e2;
-            }
+        if (needsClosestEnemy)
+          if (auto found = index.closest(pos1.v, vis.visibility,
+              dungeon::TeamSelector::except(team1.team), isVisible, e.id()))
+            closestEnemy = found->entity;
 
-            if (needsClosestAlly && team1.team == team2.team
-              && (closestAlly == noEntity || dist < closestAllyDist))
-            {
-              closestAllyDist = dist;
-              closestAlly = e2;
-            }
-          });
+        if (needsClosestAlly)
+          if (auto found = index.closest(pos1.v, vis.visibility,
+              dungeon::TeamSelector::only(team1.team), isVisible, e.id()))
+            closestAlly = found->entity;
 
         if (needsClosestAlly)
           e.add<ClosestVisibleAlly>(closestAlly);
@@ -203,10 +345,15 @@ flecs::entity register_systems(flecs::world& world)
           e.add<ClosestVisibleEnemy>(closestEnemy);
       });
 
-  world.system<flecs::query<const Position>, dungeon::dmaps::Dmap, dungeon::dmaps::PotentialHolder>()
+  world.system<flecs::query<const Position>, dungeon::dmaps::Dmap, dungeon::dmaps::PotentialHolder,
+      const dungeon::dmaps::DmapUsers>()
     .each([](flecs::entity e, flecs::query<const Position>& query, dungeon::dmaps::Dmap& dmap,
-      dungeon::dmaps::PotentialHolder& potential)
+      dungeon::dmaps::PotentialHolder& potential, const dungeon::dmaps::DmapUsers& users)
     {
+      // Dormant dmaps keep stale data until somebody needs them again
+      if (!dungeon::dmaps::is_active(dmap, users))
+        return;
+
       dungeon::dmaps::clear(dmap.view);
       query.each(
         [&](const Position& pos)